@@ -3,5 +3,417 @@
 
 #include "dmod.h"
 
+// ============================================================================
+//                      ioctl Requests
+// ============================================================================
+/**
+ * @brief Base of the dmramfs specific ioctl request numbers ('RAM' << 8)
+ */
+#define DMRAMFS_IOCTL_BASE              0x52414D00
 
-#endif // DMRAMFS_H
\ No newline at end of file
+/**
+ * @brief Read the path lookup cache statistics (arg: dmramfs_dcache_stats_t*, fp: unused)
+ */
+#define DMRAMFS_IOCTL_DCACHE_STATS      (DMRAMFS_IOCTL_BASE + 0x01)
+
+/**
+ * @brief Map a read-only view of the file data (arg: dmramfs_map_t*, fp: file handle)
+ * 
+ * The view points directly into the file storage and covers the contiguous
+ * bytes available at the requested offset (a single extent), so a whole file
+ * is read by mapping consecutive offsets. Mapping pins the file: writes,
+ * reservations and truncation fail until the handle is unmapped or closed.
+ * Mapping fails while a handle of the file has a reserved region.
+ */
+#define DMRAMFS_IOCTL_MAP               (DMRAMFS_IOCTL_BASE + 0x02)
+
+/**
+ * @brief Release all views mapped through the handle (arg: unused, fp: file handle)
+ */
+#define DMRAMFS_IOCTL_UNMAP             (DMRAMFS_IOCTL_BASE + 0x03)
+
+/**
+ * @brief Reserve a writable region at the handle position (arg: dmramfs_reserve_t*, fp: file handle)
+ * 
+ * The region points directly into the file storage and covers at most the
+ * rest of a single extent. The bytes written there within the current size
+ * of the file replace its data in place, so readers may see them before
+ * they are committed. The bytes beyond the end of file become part of it
+ * when they are committed with DMRAMFS_IOCTL_COMMIT.
+ */
+#define DMRAMFS_IOCTL_RESERVE           (DMRAMFS_IOCTL_BASE + 0x04)
+
+/**
+ * @brief Commit bytes written into the reserved region (arg: const size_t*, fp: file handle)
+ * 
+ * Extends the file if needed and advances the handle position by the
+ * committed size. Any reservation not committed is dropped.
+ */
+#define DMRAMFS_IOCTL_COMMIT            (DMRAMFS_IOCTL_BASE + 0x05)
+
+/**
+ * @brief Read at an explicit offset (arg: dmramfs_io_t*, fp: file handle)
+ * 
+ * The handle position is neither used nor modified, so several tasks can
+ * read different parts of the file through one shared handle.
+ */
+#define DMRAMFS_IOCTL_PREAD             (DMRAMFS_IOCTL_BASE + 0x06)
+
+/**
+ * @brief Write at an explicit offset (arg: dmramfs_io_t*, fp: file handle)
+ * 
+ * The handle position is neither used nor modified. Writing beyond the end
+ * of file zero-fills the gap.
+ */
+#define DMRAMFS_IOCTL_PWRITE            (DMRAMFS_IOCTL_BASE + 0x07)
+
+/**
+ * @brief Read into several buffers at the handle position (arg: dmramfs_vector_t*, fp: file handle)
+ * 
+ * The segments are filled in order until the end of file; the position
+ * advances by the number of bytes read.
+ */
+#define DMRAMFS_IOCTL_READV             (DMRAMFS_IOCTL_BASE + 0x08)
+
+/**
+ * @brief Write several buffers at the handle position (arg: dmramfs_vector_t*, fp: file handle)
+ * 
+ * The file storage grows once for the whole batch and every segment is
+ * copied straight into place; the position advances past the written data.
+ */
+#define DMRAMFS_IOCTL_WRITEV            (DMRAMFS_IOCTL_BASE + 0x09)
+
+/**
+ * @brief Queue operations for execution (arg: dmramfs_batch_t*, fp: unused)
+ * 
+ * The operations are queued in order until the queue is full; the caller
+ * keeps them alive until they are reaped. With DMRAMFS_BATCH_PROCESS the
+ * queue is executed before returning, otherwise it is executed by the next
+ * DMRAMFS_IOCTL_PROCESS (e.g. from a worker task).
+ */
+#define DMRAMFS_IOCTL_SUBMIT            (DMRAMFS_IOCTL_BASE + 0x0A)
+
+/**
+ * @brief Execute the queued operations (arg: size_t* receiving the number executed or NULL, fp: unused)
+ * 
+ * Operations are executed in submission order by one task at a time; if
+ * another task is already executing the queue, the call returns at once.
+ */
+#define DMRAMFS_IOCTL_PROCESS           (DMRAMFS_IOCTL_BASE + 0x0B)
+
+/**
+ * @brief Collect completed operations (arg: dmramfs_batch_t*, fp: unused)
+ */
+#define DMRAMFS_IOCTL_REAP              (DMRAMFS_IOCTL_BASE + 0x0C)
+
+/**
+ * @brief Create a read-only snapshot of the mount (arg: dmfsi_context_t* receiving the snapshot, fp: unused)
+ * 
+ * The snapshot is a separate mount accessed with the same interface and
+ * released with _deinit. Directories and files are copied, but the file
+ * data is shared copy-on-write, so the snapshot only costs memory for the
+ * metadata and for the data modified afterwards. Modifications of the mount
+ * wait while the snapshot is taken, so all files are captured at the same
+ * point in time.
+ */
+#define DMRAMFS_IOCTL_SNAPSHOT          (DMRAMFS_IOCTL_BASE + 0x0D)
+
+/**
+ * @brief Clone the file into a new path (arg: const char* path of the clone, fp: file handle)
+ * 
+ * The clone shares the data of the file; either of them copies only the
+ * extents it modifies. An existing file at the path is overwritten.
+ */
+#define DMRAMFS_IOCTL_CLONE             (DMRAMFS_IOCTL_BASE + 0x0E)
+
+/**
+ * @brief Read the deduplication statistics (arg: dmramfs_dedup_stats_t*, fp: unused)
+ * 
+ * Only available when built with DMRAMFS_DEDUP.
+ */
+#define DMRAMFS_IOCTL_DEDUP_STATS       (DMRAMFS_IOCTL_BASE + 0x0F)
+
+/**
+ * @brief Compress the cold files (arg: dmramfs_compress_stats_t* receiving the statistics or NULL, fp: unused)
+ * 
+ * Files without handles that were not used for DMRAMFS_COMPRESS_AGE ticks
+ * of DMRAMFS_COMPRESS_CLOCK are compressed; they are decompressed when
+ * opened again. A DMRAMFS_IOCTL_PROCESS finding the queue empty does the
+ * same. Only available when built with DMRAMFS_COMPRESS.
+ */
+#define DMRAMFS_IOCTL_COMPRESS          (DMRAMFS_IOCTL_BASE + 0x10)
+
+/**
+ * @brief Read the compression statistics (arg: dmramfs_compress_stats_t*, fp: unused)
+ */
+#define DMRAMFS_IOCTL_COMPRESS_STATS    (DMRAMFS_IOCTL_BASE + 0x11)
+
+/**
+ * @brief Read the usage and the limits of the mount (arg: dmramfs_statfs_t*, fp: unused)
+ * 
+ * The limits are set with the mount options "size=<bytes>[k|m|g]" and
+ * "nr_inodes=<count>" (comma separated) of the configuration string.
+ */
+#define DMRAMFS_IOCTL_STATFS            (DMRAMFS_IOCTL_BASE + 0x12)
+
+/**
+ * @brief Mark the file as evictable or not (arg: const bool* with the new state, fp: file handle)
+ * 
+ * Opening a file with the DMRAMFS_ATTR_EVICTABLE attribute marks it as well.
+ */
+#define DMRAMFS_IOCTL_EVICTABLE         (DMRAMFS_IOCTL_BASE + 0x13)
+
+/**
+ * @brief Remove the least recently used evictable files (arg: dmramfs_shrink_t*, fp: unused)
+ * 
+ * Only evictable files without handles are removed, the coldest first,
+ * until the goal is met or no such file is left. A write exceeding the
+ * quota of the mount evicts files the same way before it fails.
+ */
+#define DMRAMFS_IOCTL_SHRINK            (DMRAMFS_IOCTL_BASE + 0x14)
+
+/**
+ * @brief Allocate storage up to a size without changing the file size (arg: const size_t* size, fp: file handle)
+ * 
+ * Writes within the preallocated range do not allocate. Capacity beyond
+ * DMRAMFS_SHRINK_THRESHOLD is released when the last handle is closed.
+ */
+#define DMRAMFS_IOCTL_PREALLOCATE       (DMRAMFS_IOCTL_BASE + 0x15)
+
+/**
+ * @brief Truncate or extend the file to a size (arg: const size_t* size, fp: file handle)
+ * 
+ * Truncating keeps the storage as spare capacity, so it neither frees nor
+ * copies data; extending fills the new range with zeros. The handle
+ * positions are not changed.
+ */
+#define DMRAMFS_IOCTL_TRUNCATE          (DMRAMFS_IOCTL_BASE + 0x16)
+
+/**
+ * @brief Release the storage of a range of the file (arg: const dmramfs_range_t* range, fp: file handle)
+ * 
+ * The range reads as zeros afterwards; the file size is not changed. Extents
+ * entirely within the range are freed, the rest of the range is zero-filled.
+ * Fails while the handles of the file have mapped views or reserved regions.
+ */
+#define DMRAMFS_IOCTL_PUNCH_HOLE        (DMRAMFS_IOCTL_BASE + 0x17)
+
+/**
+ * @brief Get the logical and allocated size of a file (arg: dmramfs_fstat_t* fstat, fp: file handle)
+ * 
+ * Writing beyond the end of file leaves a hole, so a sparse file may use far
+ * less memory than its size.
+ */
+#define DMRAMFS_IOCTL_FSTAT             (DMRAMFS_IOCTL_BASE + 0x18)
+
+// ============================================================================
+//                      File Attributes
+// ============================================================================
+/**
+ * @brief The file holds data that can be regenerated and may be evicted (_fopen attr)
+ */
+#define DMRAMFS_ATTR_EVICTABLE          0x10000
+
+// ============================================================================
+//                      Queued Operations
+// ============================================================================
+/**
+ * @brief Open a file (path, mode, attr; receives fp)
+ */
+#define DMRAMFS_OP_OPEN                 1
+
+/**
+ * @brief Close a file (fp)
+ */
+#define DMRAMFS_OP_CLOSE                2
+
+/**
+ * @brief Read at the handle position (fp, buffer, size; receives transferred)
+ */
+#define DMRAMFS_OP_READ                 3
+
+/**
+ * @brief Write at the handle position (fp, buffer, size; receives transferred)
+ */
+#define DMRAMFS_OP_WRITE                4
+
+/**
+ * @brief Read at an explicit offset (fp, offset, buffer, size; receives transferred)
+ */
+#define DMRAMFS_OP_PREAD                5
+
+/**
+ * @brief Write at an explicit offset (fp, offset, buffer, size; receives transferred)
+ */
+#define DMRAMFS_OP_PWRITE               6
+
+/**
+ * @brief Get file statistics (path, buffer: dmfsi_stat_t*)
+ */
+#define DMRAMFS_OP_STAT                 7
+
+/**
+ * @brief Execute the queue before DMRAMFS_IOCTL_SUBMIT returns
+ */
+#define DMRAMFS_BATCH_PROCESS           0x01
+
+// ============================================================================
+//                      ioctl Arguments
+// ============================================================================
+/**
+ * @brief Statistics of the path lookup cache
+ */
+typedef struct
+{
+    uint32_t hits;          // Lookups resolved by the cache
+    uint32_t misses;        // Lookups that had to walk the directory tree
+} dmramfs_dcache_stats_t;
+
+/**
+ * @brief Read-only view of the file data
+ */
+typedef struct
+{
+    size_t          offset;     // [in] File offset of the view
+    const void*     data;       // [out] Pointer to the data at the offset
+    size_t          length;     // [out] Number of contiguous bytes at data (0 at end of file)
+} dmramfs_map_t;
+
+/**
+ * @brief Writable region of the file storage
+ */
+typedef struct
+{
+    size_t          size;       // [in] Requested number of bytes
+    void*           data;       // [out] Pointer to the region at the handle position
+    size_t          length;     // [out] Number of bytes that can be written at data
+} dmramfs_reserve_t;
+
+/**
+ * @brief Positional read or write
+ */
+typedef struct
+{
+    size_t          offset;         // [in] File offset to transfer the data at
+    void*           buffer;         // [in] Destination (read) or source (write) of the data
+    size_t          size;           // [in] Number of bytes to transfer
+    size_t          transferred;    // [out] Number of bytes read or written
+} dmramfs_io_t;
+
+/**
+ * @brief Single segment of a vectored read or write
+ */
+typedef struct
+{
+    void*           base;           // Buffer of the segment
+    size_t          length;         // Length of the segment in bytes
+} dmramfs_iovec_t;
+
+/**
+ * @brief Vectored read or write
+ */
+typedef struct
+{
+    const dmramfs_iovec_t*  iov;            // [in] Segments in file order
+    size_t                  count;          // [in] Number of segments
+    size_t                  transferred;    // [out] Total number of bytes read or written
+} dmramfs_vector_t;
+
+/**
+ * @brief Deduplication statistics
+ * 
+ * The deduplication ratio is references / blocks: the number of blocks the
+ * files would occupy without deduplication per block actually stored.
+ */
+typedef struct
+{
+    size_t  blocks;         // Number of distinct blocks stored in the deduplication table
+    size_t  references;     // Number of file blocks referencing them
+    size_t  block_size;     // Size of a block in bytes
+} dmramfs_dedup_stats_t;
+
+/**
+ * @brief Compression statistics
+ */
+typedef struct
+{
+    size_t  files;          // Number of compressed files
+    size_t  raw_bytes;      // Size of their data
+    size_t  packed_bytes;   // Size of their compressed data
+} dmramfs_compress_stats_t;
+
+/**
+ * @brief Usage and limits of a mount
+ * 
+ * Every file is charged for the extents it references, even if they are
+ * shared with other files. Metadata covers the nodes, names, handles,
+ * directory indexes and extent tables.
+ */
+typedef struct
+{
+    size_t  quota_bytes;        // Limit of data_bytes + metadata_bytes, 0 if unlimited
+    size_t  data_bytes;         // Bytes of file data storage
+    size_t  metadata_bytes;     // Bytes of metadata storage
+    size_t  quota_inodes;       // Limit of inodes, 0 if unlimited
+    size_t  inodes;             // Number of files and directories
+} dmramfs_statfs_t;
+
+/**
+ * @brief Request of the shrinker
+ */
+typedef struct
+{
+    size_t  goal;               // Number of data bytes to release (SIZE_MAX to evict everything possible)
+    size_t  released;           // Receives the number of data bytes released
+    size_t  files;              // Receives the number of files removed
+} dmramfs_shrink_t;
+
+/**
+ * @brief Range of a file
+ */
+typedef struct
+{
+    size_t  offset;             // Offset of the range
+    size_t  length;             // Size of the range in bytes
+} dmramfs_range_t;
+
+/**
+ * @brief Sizes of a file
+ */
+typedef struct
+{
+    size_t  size;               // Logical size in bytes
+    size_t  allocated;          // Bytes of the extents backing the data (0 for holes and inline data)
+} dmramfs_fstat_t;
+
+/**
+ * @brief Operation descriptor for the submission queue
+ */
+typedef struct dmramfs_op
+{
+    int                 opcode;         // [in] DMRAMFS_OP_*
+    const char*         path;           // [in] Path (OPEN, STAT)
+    void*               fp;             // [in/out] File handle (received by OPEN)
+    struct dmramfs_op*  link;           // [in] Earlier operation to take the file handle from, or NULL
+    int                 mode;           // [in] Open mode (OPEN)
+    int                 attr;           // [in] Open attributes (OPEN)
+    size_t              offset;         // [in] File offset (PREAD, PWRITE)
+    void*               buffer;         // [in] Data buffer, or dmfsi_stat_t* for STAT
+    size_t              size;           // [in] Number of bytes to transfer
+    size_t              transferred;    // [out] Number of bytes read or written
+    int                 result;         // [out] DMFSI_OK or an error code
+    void*               user_data;      // Not used by the file system
+} dmramfs_op_t;
+
+/**
+ * @brief Batch of operations to submit or reap
+ */
+typedef struct
+{
+    dmramfs_op_t**  ops;        // [in] Operations to submit, or [out] completed operations
+    size_t          count;      // [in] Number of entries of ops
+    size_t          done;       // [out] Number of operations submitted or reaped
+    int             flags;      // [in] DMRAMFS_BATCH_* (SUBMIT only)
+} dmramfs_batch_t;
+
+#endif // DMRAMFS_H
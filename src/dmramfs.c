@@ -3,55 +3,511 @@
 #include "dmod.h"
 #include "dmramfs.h"
 #include "dmfsi.h"
-#include "dmlist.h"
 #include <string.h>
 
+/**
+ * @brief Enable the built-in locking, so a mount can be shared by multiple tasks
+ * 
+ * Set to 0 on single-task systems to compile all locks out.
+ */
+#ifndef DMRAMFS_THREAD_SAFE
+#   define DMRAMFS_THREAD_SAFE 1
+#endif
+
+#if DMRAMFS_THREAD_SAFE
+#   include <stdatomic.h>
+#   define DMRAMFS_ATOMIC(type) _Atomic(type)
+#else
+#   define DMRAMFS_ATOMIC(type) type
+#endif
+
+/**
+ * @brief Maximal number of tasks traversing the tree of a mount at the same time
+ * 
+ * Lock-free lookups occupy a reader slot; further tasks wait for a free one.
+ */
+#ifndef DMRAMFS_EPOCH_READERS
+#   define DMRAMFS_EPOCH_READERS 8
+#endif
+
+/**
+ * @brief Number of times the lock loops spin before a waiting task yields
+ */
+#ifndef DMRAMFS_LOCK_SPINS
+#   define DMRAMFS_LOCK_SPINS 64
+#endif
+
+/**
+ * @brief Hook yielding the CPU in the lock loops once the spins are used up
+ * 
+ * A busy spin alone livelocks on a single core with a preemptive scheduler,
+ * because the lower priority task holding the lock never runs.
+ */
+#ifndef DMRAMFS_LOCK_RELAX
+#   define DMRAMFS_LOCK_RELAX() Dmod_SleepMs(1)
+#endif
+
 /** 
  * @brief Magic number for RAMFS context validation
  */
 #define DMRAMFS_CONTEXT_MAGIC 0x52414D46  // 'RAMF'
 
+/**
+ * @brief Size of a single file data extent in bytes
+ * 
+ * File contents are stored as a tree of fixed-size extents, so growing a
+ * file only allocates new extents and never copies the data already written.
+ */
+#ifndef DMRAMFS_EXTENT_SIZE
+#   define DMRAMFS_EXTENT_SIZE 512
+#endif
+
+/**
+ * @brief Spare capacity (in bytes) a file may keep after its last handle is closed
+ * 
+ * Truncated files keep their extents so rewrite-in-place workloads do not
+ * allocate; when the last handle is closed, spare extents beyond this limit
+ * are released. Set to 0 to keep all spare capacity.
+ */
+#ifndef DMRAMFS_SHRINK_THRESHOLD
+#   define DMRAMFS_SHRINK_THRESHOLD 4096
+#endif
+
+/**
+ * @brief Size of the data stored in the file node itself (at most DMRAMFS_EXTENT_SIZE)
+ * 
+ * Files that never grow beyond it need no extents. The default keeps the
+ * file node in the 192 byte class of the slab allocator.
+ */
+#ifndef DMRAMFS_INLINE_SIZE
+#   define DMRAMFS_INLINE_SIZE 32
+#endif
+
+/**
+ * @brief Size of the name buffer of a file or directory node (including the terminator)
+ * 
+ * Shorter names are stored in the node itself, longer ones in the slabs of
+ * the mount.
+ */
+#ifndef DMRAMFS_SHORT_NAME_SIZE
+#   define DMRAMFS_SHORT_NAME_SIZE 16
+#endif
+
+/**
+ * @brief Cached name length of the names of this length or longer
+ */
+#define DMRAMFS_NAME_LEN_LONG 0xFF
+
+/**
+ * @brief Number of bits of an extent index resolved by each level of the extents tree
+ * 
+ * A node of DMRAMFS_EXTENT_FANOUT pointers fits the slab allocator, and only
+ * the nodes leading to allocated extents exist - holes take no memory.
+ */
+#define DMRAMFS_EXTENT_FANOUT_BITS 4
+
+/**
+ * @brief Number of entries of a node of the extents tree
+ */
+#define DMRAMFS_EXTENT_FANOUT (1u << DMRAMFS_EXTENT_FANOUT_BITS)
+
+/**
+ * @brief Size of a single page of the per-mount slab allocator
+ */
+#ifndef DMRAMFS_SLAB_PAGE_SIZE
+#   define DMRAMFS_SLAB_PAGE_SIZE 2048
+#endif
+
+/**
+ * @brief Size reserved for the slab page header (keeps the objects aligned)
+ */
+#define DMRAMFS_SLAB_HEADER_SIZE 16
+
+/**
+ * @brief Number of object size classes served by the slab allocator
+ */
+#define DMRAMFS_SLAB_CLASS_COUNT 8
+
+/**
+ * @brief Object sizes served by the slab allocator (larger objects go to the heap)
+ */
+static const size_t slab_class_sizes[DMRAMFS_SLAB_CLASS_COUNT] = { 16, 24, 32, 48, 64, 96, 128, 192 };
+
+/**
+ * @brief Minimal number of slots of a directory index
+ */
+#define DMRAMFS_INDEX_MIN_CAPACITY 8
+
+/**
+ * @brief Number of old index slots migrated by every index modification
+ */
+#define DMRAMFS_INDEX_MIGRATE_STEP 4
+
+/**
+ * @brief Number of entries of the per-mount path lookup cache (power of two, at most 32768)
+ */
+#ifndef DMRAMFS_DCACHE_SIZE
+#   define DMRAMFS_DCACHE_SIZE 64
+#endif
+// Slots are selected by masking the hash and stored plus one in a uint16_t
+#if DMRAMFS_DCACHE_SIZE < 1 || DMRAMFS_DCACHE_SIZE > 65535 || (DMRAMFS_DCACHE_SIZE & (DMRAMFS_DCACHE_SIZE - 1)) != 0
+#   error "DMRAMFS_DCACHE_SIZE must be a power of two between 1 and 32768"
+#endif
+
+/**
+ * @brief Share identical full extents between files (block-level deduplication)
+ * 
+ * The extents of a file are deduplicated when its last handle is closed.
+ */
+#ifndef DMRAMFS_DEDUP
+#   define DMRAMFS_DEDUP 0
+#endif
+
+/**
+ * @brief Number of buckets (power of two) of the table of deduplicated extents
+ */
+#ifndef DMRAMFS_DEDUP_BUCKETS
+#   define DMRAMFS_DEDUP_BUCKETS 1024
+#endif
+#if DMRAMFS_DEDUP_BUCKETS < 1 || (DMRAMFS_DEDUP_BUCKETS & (DMRAMFS_DEDUP_BUCKETS - 1)) != 0
+#   error "DMRAMFS_DEDUP_BUCKETS must be a power of two"
+#endif
+
+/**
+ * @brief Compress the data of files that are not in use (built-in LZ codec)
+ * 
+ * A compressed file is decompressed when it is opened again.
+ */
+#ifndef DMRAMFS_COMPRESS
+#   define DMRAMFS_COMPRESS 0
+#endif
+
+/**
+ * @brief Time after which a closed file is cold, in DMRAMFS_COMPRESS_CLOCK units
+ * 
+ * Cold files are compressed by DMRAMFS_IOCTL_COMPRESS and by an idle
+ * DMRAMFS_IOCTL_PROCESS. With 0, files are compressed as soon as their
+ * last handle is closed.
+ */
+#ifndef DMRAMFS_COMPRESS_AGE
+#   define DMRAMFS_COMPRESS_AGE 32
+#endif
+
+/**
+ * @brief Current time of the mount for the coldness of files (uint32_t)
+ * 
+ * Defaults to the tick of the mount, advanced by every DMRAMFS_IOCTL_PROCESS
+ * and DMRAMFS_IOCTL_COMPRESS, so files of a mount serviced only by a worker
+ * task still get cold. Can be defined as a platform clock (e.g. milliseconds).
+ */
+#ifndef DMRAMFS_COMPRESS_CLOCK
+#   define DMRAMFS_COMPRESS_CLOCK(ctx) counter_get(&(ctx)->tick)
+#endif
+
+/**
+ * @brief Number of bits of the match finder hash table of the compressor
+ */
+#define DMRAMFS_LZ_HASH_BITS    10
+
+/**
+ * @brief Shortest match encoded by the compressor
+ */
+#define DMRAMFS_LZ_MIN_MATCH    4
+
+/**
+ * @brief Largest distance of a match encoded by the compressor
+ */
+#define DMRAMFS_LZ_MAX_OFFSET   0xFFFF
+
+/**
+ * @brief Capacity of the per-mount queue of submitted and completed operations
+ */
+#ifndef DMRAMFS_QUEUE_SIZE
+#   define DMRAMFS_QUEUE_SIZE 32
+#endif
+
+/**
+ * @brief Initial value of the FNV-1a hash
+ */
+#define DMRAMFS_HASH_SEED 2166136261u
+
+/**
+ * @brief Marker of a removed entry in a directory index
+ */
+#define DMRAMFS_INDEX_TOMBSTONE ((entry_t*)&index_tombstone)
+
+/**
+ * @brief Lock state bit of a reader/writer lock held by a writer
+ */
+#define DMRAMFS_RWLOCK_WRITER   0x80000000u
+
+/**
+ * @brief Lock state bit of a reader/writer lock a writer is waiting for (blocks new readers)
+ */
+#define DMRAMFS_RWLOCK_PENDING  0x40000000u
+
+/**
+ * @brief Reader slot bit marking a task inside a lock-free section
+ */
+#define DMRAMFS_EPOCH_ACTIVE    0x80000000u
+
+/*
+ * Locking
+ * 
+ * Every directory and every file carries a reader/writer lock:
+ *  - the directory lock guards its index, its list of children and its handles,
+ *  - the file lock guards the data, the size, the handles and the pins.
+ * The path lookup cache has its own lock, and the mount lock guards the slab
+ * allocator and the mount-wide lists. The snapshot barrier is held shared by
+ * every operation changing the contents of the mount and exclusively by a
+ * snapshot, so a snapshot sees all files at a single point in time.
+ * 
+ * Locks are always taken in this order:
+ *  1. the snapshot barrier - taken once per entry point, never nested,
+ *  2. a directory lock - at most one directory is locked at a time, which is
+ *     safe because directories are never freed while the mount exists,
+ *  3. the path cache lock,
+ *  4. a file lock,
+ *  5. the deduplication lock,
+ *  6. the retire lock,
+ *  7. the mount lock - nothing else is locked while it is held.
+ * 
+ * Lookups do not lock directories or the path cache. Directory tables and
+ * names are published with atomic stores, and a task traversing the tree
+ * occupies a reader slot tagged with the current epoch. Objects unlinked by
+ * writers are retired instead of freed and only released once the epoch has
+ * advanced twice - by then no reader can still see them. Nothing is retired
+ * while a file lock is held, since readers may wait for file locks.
+ * 
+ * _unlink write-locks the directory and the file, marks the file unlinked and
+ * only then drops it from the path cache and the directory. A lookup that
+ * found the file concurrently locks it, sees the mark and looks again.
+ * _rename only renames within a write-locked directory; the old name is
+ * retired, so concurrent lookups can still compare against it.
+ */
+
+/**
+ * @brief Reader/writer lock (a zeroed lock is unlocked)
+ */
+typedef struct
+{
+#if DMRAMFS_THREAD_SAFE
+    atomic_uint state;          // Number of readers and the WRITER/PENDING bits
+#else
+    uint8_t     unused;
+#endif
+} rwlock_t;
+
+/**
+ * @brief Statistics counter updated by concurrent readers
+ */
+#if DMRAMFS_THREAD_SAFE
+typedef atomic_uint counter_t;
+#else
+typedef uint32_t counter_t;
+#endif
+
+/**
+ * @brief Single component of a path, pointing into the original path string
+ */
+typedef struct
+{
+    const char* name;       // Not NUL terminated
+    size_t      len;
+} path_component_t;
+
+typedef struct file         file_t;
+typedef struct file_handle  file_handle_t;
+typedef struct dir          dir_t;
+typedef struct dir_handle   dir_handle_t;
+
+/**
+ * @brief Common header of files and directories
+ */
+typedef struct entry
+{
+    DMRAMFS_ATOMIC(char*) name;     // short_name or a name allocated from the slabs
+    uint32_t    hash;       // Cached hash of the name
+    uint16_t    dcache_slot;    // Path cache slot + 1, 0 if not cached
+    bool        is_dir;
+    DMRAMFS_ATOMIC(uint8_t) name_len;   // Cached length of the name (DMRAMFS_NAME_LEN_LONG if longer)
+    dir_t*      parent;
+    struct entry* prev_sibling; // Previous child of the parent (in creation order)
+    struct entry* next_sibling; // Next child of the parent (in creation order)
+    char        short_name[DMRAMFS_SHORT_NAME_SIZE];
+} entry_t;
+
+/**
+ * @brief Single slot of a directory index
+ */
+typedef struct
+{
+    DMRAMFS_ATOMIC(uint32_t) hash;
+    DMRAMFS_ATOMIC(entry_t*) entry;     // NULL if the slot is empty
+} index_slot_t;
+
+/**
+ * @brief Table of a directory index
+ */
+typedef struct index_table
+{
+    size_t          capacity;           // Number of slots (power of two)
+    DMRAMFS_ATOMIC(struct index_table*) old;    // Table being migrated into this one, if any
+    index_slot_t    slots[];
+} index_table_t;
+
+/**
+ * @brief Size in bytes of an index table with the given number of slots
+ */
+#define DMRAMFS_INDEX_TABLE_SIZE(capacity)  (sizeof(index_table_t) + (capacity) * sizeof(index_slot_t))
+
+/**
+ * @brief Open addressing hash table over the children of a directory
+ * 
+ * When the table grows, the old table is kept and migrated a few slots at a
+ * time by subsequent modifications, so no single insert pays for a full
+ * rehash. Lookups check both tables until the migration is complete.
+ * 
+ * The current table (with the table being migrated) is published with a
+ * single store, so lock-free readers always see a consistent pair.
+ */
+typedef struct
+{
+    DMRAMFS_ATOMIC(index_table_t*) table;
+    size_t          count;          // Live entries in both tables
+    uint32_t        used;           // Live and removed slots in the current table
+    uint32_t        migrated;       // Number of old slots already migrated
+} dir_index_t;
+
+/**
+ * @brief Chunk of file data, shared copy-on-write by clones and snapshots
+ * 
+ * An extent referenced by more than one file is never modified in place;
+ * the writer copies it first (see file_unshare).
+ */
+typedef struct extent
+{
+    DMRAMFS_ATOMIC(uint32_t) refs;      // Number of files referencing the extent (+1 if deduplicated)
+    uint32_t        hash;               // Hash of the data (valid if deduplicated)
+#if DMRAMFS_DEDUP
+    bool            deduplicated;       // Stored in the deduplication table
+    struct extent*  dedup_next;         // Next extent of the same bucket
+#endif
+    unsigned char   data[DMRAMFS_EXTENT_SIZE];
+} extent_t;
+
+/**
+ * @brief Node of the extents tree of a file (allocated from the mount slabs)
+ */
+typedef union extent_node
+{
+    union extent_node*  children[DMRAMFS_EXTENT_FANOUT];   // Subtrees (upper levels)
+    extent_t*           extents[DMRAMFS_EXTENT_FANOUT];    // Extents (lowest level, NULL for holes)
+} extent_node_t;
+
 /** 
  * @brief File structure
  */
-typedef struct 
+struct file
 {
-    char* file_name;
-    void* data;
+    entry_t entry;
+    extent_node_t* extents; // Tree of DMRAMFS_EXTENT_SIZE data chunks (missing entries are holes)
+    size_t extent_count;    // Number of entries up to the last extent of the tree (capacity)
+    unsigned extent_height; // Number of levels of the extents tree
     size_t size;
-    dmlist_context_t* handles;
-} file_t;
+    unsigned char inline_data[DMRAMFS_INLINE_SIZE];   // Data of a file without extents
+    file_handle_t* handles; // List of the handles opened for this file
+    dmfsi_context_t mount;  // Mount charged for the extents of the file
+    uint32_t pins;          // Number of handles with mapped views of the data
+    rwlock_t lock;
+    DMRAMFS_ATOMIC(bool) unlinked;  // Removed from its directory, waiting to be released
+    bool evictable;         // May be removed by the shrinker when it has no handles
+#if DMRAMFS_COMPRESS
+    uint32_t last_used;     // DMRAMFS_COMPRESS_CLOCK when the last handle was closed
+    size_t packed_size;     // Size of the compressed data held by the extents, 0 if not compressed
+#endif
+    file_t* lru_prev;       // Previous (colder) file in the eviction list
+    file_t* lru_next;       // Next (more recently used) file in the eviction list
+    file_t* mount_prev;     // Previous file in the mount-wide list
+    file_t* mount_next;     // Next file in the mount-wide list
+};
 
 /** 
  * @brief File handle structure
  */
-typedef struct 
+struct file_handle
 {
     file_t* file;
     int mode;
     int attribute;
     size_t position;    // Current read/write position
-} file_handle_t;
+    bool mapped;        // The handle holds a pin on the file data
+    size_t reserved;    // Bytes reserved for writing at the position
+    extent_t* window;       // Extent cached for character I/O (NULL if none)
+    size_t window_start;    // File offset of the cached extent
+    file_handle_t* next;    // Next handle of the same file
+};
 
 /** 
  * @brief Directory structure
  */
-typedef struct dir
+struct dir
 {
-    char* dir_name;
-    dmlist_context_t* files;
-    dmlist_context_t* dirs;
-} dir_t;
+    entry_t entry;
+    dir_index_t children;   // Files and subdirectories
+    entry_t* first_child;   // Children in creation order (for readdir)
+    entry_t* last_child;
+    dir_handle_t* handles;  // Handles opened for this directory
+    dir_t* mount_next;      // Next directory in the mount-wide list
+    rwlock_t lock;
+};
 
 /**
  * @brief Directory handle structure for reading directory entries
  */
-typedef struct
+struct dir_handle
 {
     dir_t* dir;
-    size_t file_index;  // Current index in files list
-    size_t dir_index;   // Current index in dirs list
-} dir_handle_t;
+    entry_t* cursor;        // Next entry to return (NULL at the end)
+    dir_handle_t* next;     // Next handle of the same directory
+};
+
+/**
+ * @brief Single entry of the path lookup cache
+ */
+typedef struct
+{
+    DMRAMFS_ATOMIC(uint32_t) hash;      // Hash of the normalized path
+    DMRAMFS_ATOMIC(entry_t*) entry;     // Resolved file or directory, NULL if unused
+} dcache_slot_t;
+
+/**
+ * @brief Object waiting until no lock-free reader can see it anymore
+ */
+typedef struct retired
+{
+    void*           ptr;
+    size_t          size;           // Size the object was allocated with
+    uint32_t        epoch;          // Epoch the object was retired in
+    struct retired* next;
+} retired_t;
+
+/**
+ * @brief Slab of fixed-size objects
+ */
+typedef struct slab_page
+{
+    struct slab_page* next;
+} slab_page_t;
+
+/**
+ * @brief Single size class of the slab allocator
+ */
+typedef struct
+{
+    void*             free_list;    // Free objects, linked through their first word
+    slab_page_t*      pages;        // All pages allocated for this class
+} slab_t;
 
 /**
  * @brief File system context structure
@@ -59,25 +515,177 @@ typedef struct
 struct dmfsi_context
 {
     uint32_t          magic;
+    bool              read_only;    // Snapshot mount - modifications are rejected
+    size_t            quota_bytes;  // Limit of the data and metadata bytes, 0 if unlimited
+    size_t            quota_inodes; // Limit of the number of files and directories, 0 if unlimited
+    DMRAMFS_ATOMIC(size_t) used_bytes;      // Bytes charged against the quota (data and metadata)
+    DMRAMFS_ATOMIC(size_t) data_bytes;      // Bytes of the extents referenced by the files
+    DMRAMFS_ATOMIC(size_t) metadata_bytes;  // Bytes of the slab pages, large objects and extent tables
+    DMRAMFS_ATOMIC(size_t) inodes;          // Number of files and directories
+    DMRAMFS_ATOMIC(size_t) shortfall;       // Bytes missing for the last charge refused by the quota
     dir_t*            root_dir;
+    file_t*           files;        // All files of the mount
+    file_t*           lru_head;     // Coldest evictable file without handles
+    file_t*           lru_tail;     // Most recently closed evictable file
+    rwlock_t          lru_lock;     // Guards the eviction list (taken after the file locks)
+    dir_t*            dirs;         // All directories of the mount
+    slab_t            slabs[DMRAMFS_SLAB_CLASS_COUNT];
+    dcache_slot_t     dcache[DMRAMFS_DCACHE_SIZE];
+    counter_t         dcache_hits;
+    counter_t         dcache_misses;
+#if DMRAMFS_COMPRESS
+    counter_t         tick;         // Worker passes and compressions (default DMRAMFS_COMPRESS_CLOCK)
+#endif
+    rwlock_t          dcache_lock;  // Serializes the modifications of the path lookup cache
+    rwlock_t          mount_lock;   // Guards the slabs and the mount-wide lists
+    DMRAMFS_ATOMIC(uint32_t) epoch; // Current reclamation epoch
+    DMRAMFS_ATOMIC(uint32_t) epoch_readers[DMRAMFS_EPOCH_READERS];  // Epochs of the lock-free readers
+    retired_t*        retired;      // Objects waiting for reclamation
+    rwlock_t          retire_lock;  // Guards the retired list and the epoch advancing
+    dmramfs_op_t*     submitted[DMRAMFS_QUEUE_SIZE];    // Ring of operations waiting for execution
+    size_t            submitted_head;
+    size_t            submitted_count;
+    dmramfs_op_t*     completed[DMRAMFS_QUEUE_SIZE];    // Ring of operations waiting to be reaped
+    size_t            completed_head;
+    size_t            completed_count;
+    bool              processing;   // A task is executing the queue
+    rwlock_t          queue_lock;   // Guards the queue (nothing else is locked while it is held)
+    rwlock_t          barrier;      // Held shared by the modifications, exclusively by a snapshot
 };
 
+#if DMRAMFS_DEDUP
+/**
+ * @brief Extents available for sharing, by the hash of their data
+ * 
+ * The table is shared by all mounts, as snapshots share extents between
+ * mounts. It holds a reference to every extent it contains, so these are
+ * always copied before being modified; an extent is removed when the table
+ * holds the last reference.
+ */
+static extent_t* dedup_table[DMRAMFS_DEDUP_BUCKETS];
+static rwlock_t  dedup_lock;
+#endif
+
+/**
+ * @brief Zeros viewed in place of the holes of sparse files
+ */
+static const unsigned char hole_data[DMRAMFS_EXTENT_SIZE];
+
 
 // ============================================================================
 //                      Local Prototypes
 // ============================================================================
-static int              compare_file_name       (const void* a, const void* b);
-static int              compare_dir_name        (const void* a, const void* b);
-static int              compare_handle_ptr      (const void* a, const void* b);
-static int              compare_file_ptr        (const void* a, const void* b);
-static file_t*          find_file               (dir_t* dir, dmfsi_path_t* path);
-static dir_t*           find_dir                (dir_t* dir, dmfsi_path_t* path);
-static file_t*          create_file             (dir_t* dir, dmfsi_path_t* path);
-static file_handle_t*   create_file_handle      (file_t* file, int mode, int attribute);
-static dir_t*           create_dir              (dir_t* parent, dmfsi_path_t* path);
-static dir_t*           create_root_dir         (void);
-static void             free_file               (file_t* file);
-static void             free_dir                (dir_t* dir);
+static void             rwlock_lock             (rwlock_t* lock, bool exclusive);
+static void             rwlock_unlock           (rwlock_t* lock, bool exclusive);
+static void             counter_add             (counter_t* counter);
+static uint32_t         counter_get             (counter_t* counter);
+static unsigned         epoch_enter             (dmfsi_context_t ctx);
+static void             epoch_exit              (dmfsi_context_t ctx, unsigned reader);
+static void             epoch_retire            (dmfsi_context_t ctx, void* ptr, size_t size);
+static void             epoch_release           (dmfsi_context_t ctx);
+#if DMRAMFS_THREAD_SAFE
+static void             lock_relax              (unsigned* spins);
+static void             epoch_try_advance       (dmfsi_context_t ctx);
+static uint32_t         epoch_age               (dmfsi_context_t ctx, uint32_t epoch);
+#endif
+static uint32_t         hash_bytes              (uint32_t hash, const char* data, size_t len);
+static uint32_t         name_hash               (const char* name, size_t len);
+static entry_t*         index_find              (const dir_index_t* index, const char* name, size_t len, bool is_dir);
+static int              index_grow              (dmfsi_context_t ctx, dir_index_t* index);
+static int              index_reserve           (dmfsi_context_t ctx, dir_index_t* index);
+static int              index_insert            (dmfsi_context_t ctx, dir_index_t* index, entry_t* entry);
+static void             index_remove            (dmfsi_context_t ctx, dir_index_t* index, entry_t* entry);
+static void             index_free              (dmfsi_context_t ctx, dir_index_t* index);
+static int              dir_add_child           (dmfsi_context_t ctx, dir_t* dir, entry_t* entry);
+static void             dir_remove_child        (dmfsi_context_t ctx, dir_t* dir, entry_t* entry);
+static int              slab_class_index        (size_t size);
+static void*            mount_alloc             (dmfsi_context_t ctx, size_t size);
+static void*            mount_alloc_object      (dmfsi_context_t ctx, size_t size, bool limited);
+static void             mount_free              (dmfsi_context_t ctx, void* ptr, size_t size);
+static char*            mount_strndup           (dmfsi_context_t ctx, const char* str, size_t len);
+static void             mount_free_string       (dmfsi_context_t ctx, char* str);
+static bool             entry_init_name         (dmfsi_context_t ctx, entry_t* entry, const char* name, size_t len);
+static void             entry_free_name         (dmfsi_context_t ctx, entry_t* entry);
+static bool             entry_name_is           (const entry_t* entry, const char* name, size_t len);
+static void             mount_release           (dmfsi_context_t ctx);
+static bool             mount_configure         (dmfsi_context_t ctx, const char* config);
+static bool             mount_reserve_bytes     (dmfsi_context_t ctx, size_t size, bool limited);
+static bool             mount_charge            (dmfsi_context_t ctx, size_t size);
+static void             mount_uncharge          (dmfsi_context_t ctx, size_t size);
+static bool             mount_charge_metadata   (dmfsi_context_t ctx, size_t size, bool limited);
+static void             mount_uncharge_metadata (dmfsi_context_t ctx, size_t size);
+static bool             mount_add_inode         (dmfsi_context_t ctx);
+static size_t           mount_evict             (dmfsi_context_t ctx, size_t goal, size_t* files);
+static bool             mount_make_room         (dmfsi_context_t ctx, int result);
+static bool             rwlock_try_lock         (rwlock_t* lock);
+static void             file_lru_insert         (file_t* file);
+static void             file_lru_remove         (file_t* file);
+static bool             path_next               (const char** path, path_component_t* component);
+static dir_t*           resolve_parent          (dmfsi_context_t ctx, const char* path, path_component_t* last);
+static entry_t*         dcache_lookup           (dmfsi_context_t ctx, const char* path, bool is_dir, uint32_t* hash);
+static void             dcache_insert           (dmfsi_context_t ctx, uint32_t hash, entry_t* entry);
+static void             dcache_forget           (dmfsi_context_t ctx, entry_t* entry);
+static file_t*          find_file               (dmfsi_context_t ctx, const char* path, bool exclusive);
+static dir_t*           find_dir                (dmfsi_context_t ctx, const char* path);
+static file_t*          create_file             (dmfsi_context_t ctx, const char* path);
+static file_handle_t*   create_file_handle      (dmfsi_context_t ctx, file_t* file, int mode, int attribute);
+static void             mount_add_file          (dmfsi_context_t ctx, file_t* file);
+static dir_t*           alloc_dir               (dmfsi_context_t ctx, dir_t* parent, const char* name, size_t len);
+static dir_t*           create_dir              (dmfsi_context_t ctx, const char* path);
+static dir_t*           create_root_dir         (dmfsi_context_t ctx);
+static extent_t*        extent_alloc            (void);
+static void             extent_release          (extent_t* extent);
+static size_t           extent_span             (unsigned height);
+static bool             extent_node_release     (dmfsi_context_t ctx, extent_node_t* node, unsigned height, size_t base, size_t first, size_t last, size_t* released);
+static extent_t**       file_extent_slot        (file_t* file, size_t index, bool create);
+static extent_t*        file_extent             (file_t* file, size_t index);
+static extent_t**       file_next_extent        (file_t* file, size_t* index, size_t end);
+static size_t           file_release_extents    (file_t* file, size_t first, size_t last);
+static int              file_reserve            (file_t* file, size_t offset, size_t end);
+static size_t           file_stored_size        (file_t* file);
+static unsigned char*   file_data_at            (file_t* file, size_t offset, size_t* length);
+static void             file_take_data          (file_t* file, file_t* source);
+static int              file_unshare            (file_t* file, size_t offset, size_t size);
+static int              file_share_data         (file_t* file, file_t* source);
+#if DMRAMFS_COMPRESS
+static unsigned char*   file_byte               (file_t* file, size_t offset);
+static int              lz_put_length           (file_t* packed, size_t length);
+static int              lz_emit                 (file_t* packed, file_t* file, size_t literal, size_t literal_len, size_t offset, size_t match_len);
+static int              file_pack               (file_t* file);
+static int              file_unpack             (file_t* file);
+static void             mount_compress          (dmfsi_context_t ctx, bool compress, dmramfs_compress_stats_t* stats);
+#endif
+#if DMRAMFS_DEDUP
+static void             file_dedup              (file_t* file);
+static void             dedup_stats             (dmramfs_dedup_stats_t* stats);
+#endif
+static size_t           file_read_at            (file_t* file, size_t offset, void* buffer, size_t size);
+static void             file_write_at           (file_t* file, size_t offset, const void* buffer, size_t size);
+static int              file_write              (file_t* file, size_t offset, const void* buffer, size_t size);
+static void             file_extend             (file_t* file, size_t offset, size_t end);
+static int              file_preallocate        (file_t* file, size_t size);
+static int              file_truncate           (file_t* file, size_t size);
+static int              file_punch_hole         (file_t* file, size_t offset, size_t length);
+static int              file_readv              (file_t* file, size_t offset, dmramfs_vector_t* vector);
+static int              file_writev             (file_t* file, size_t offset, dmramfs_vector_t* vector);
+static int              file_map                (file_handle_t* handle, dmramfs_map_t* map);
+static int              file_reserve_view       (file_handle_t* handle, dmramfs_reserve_t* reserve);
+static int              file_commit             (file_handle_t* handle, size_t size);
+static void             file_unmap              (file_handle_t* handle);
+static void             handle_set_window       (file_handle_t* handle);
+static void             file_drop_windows       (file_t* file);
+static void             file_zero_range         (file_t* file, size_t offset, size_t size);
+static void             file_shrink             (file_t* file, size_t spare);
+static void             file_free_data          (file_t* file);
+static size_t           file_allocated          (file_t* file);
+static void             free_file               (dmfsi_context_t ctx, file_t* file);
+static int              file_clone              (dmfsi_context_t ctx, file_t* source, const char* path);
+static int              mount_snapshot          (dmfsi_context_t ctx, dmfsi_context_t* snapshot);
+static int              snapshot_dir            (dmfsi_context_t ctx, dmfsi_context_t snapshot, dir_t* source, dir_t* dir);
+static size_t           queue_submit            (dmfsi_context_t ctx, dmramfs_batch_t* batch);
+static size_t           queue_process           (dmfsi_context_t ctx);
+static size_t           queue_reap              (dmfsi_context_t ctx, dmramfs_batch_t* batch);
+static void             queue_execute           (dmfsi_context_t ctx, dmramfs_op_t* op);
 
 
 // ============================================================================
@@ -124,11 +732,18 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, dmfsi_context_t, _init, (const cha
         DMOD_LOG_ERROR("dmramfs: Failed to allocate memory for context\n");
         return NULL;
     }
+    memset(ctx, 0, sizeof(struct dmfsi_context));
     ctx->magic = DMRAMFS_CONTEXT_MAGIC;
-    ctx->root_dir = create_root_dir();
+    if (!mount_configure(ctx, config))
+    {
+        Dmod_Free(ctx);
+        return NULL;
+    }
+    ctx->root_dir = create_root_dir(ctx);
     if (ctx->root_dir == NULL)
     {
         DMOD_LOG_ERROR("dmramfs: Failed to create root directory\n");
+        mount_release(ctx);
         Dmod_Free(ctx);
         return NULL;
     }
@@ -142,10 +757,28 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, int, _deinit, (dmfsi_context_t ctx
 {
     if (ctx)
     {
-        if (ctx->root_dir)
+        // Release the heap-backed parts of every node in a single pass -
+        // handles and names live in the slabs, and so do the nodes unless a
+        // large DMRAMFS_INLINE_SIZE makes files bigger than any size class
+        bool heap_files = (slab_class_index(sizeof(file_t)) < 0);
+        for (file_t* file = ctx->files, *next; file != NULL; file = next)
+        {
+            next = file->mount_next;
+            file_free_data(file);
+            entry_free_name(ctx, &file->entry);
+            if (heap_files)
+            {
+                mount_free(ctx, file, sizeof(file_t));
+            }
+        }
+        for (dir_t* dir = ctx->dirs; dir != NULL; dir = dir->mount_next)
         {
-            free_dir(ctx->root_dir);
+            index_free(ctx, &dir->children);
+            entry_free_name(ctx, &dir->entry);
         }
+        epoch_release(ctx);
+        mount_release(ctx);
+        ctx->magic = 0;
         Dmod_Free(ctx);
     }
     return DMFSI_OK;
@@ -170,28 +803,47 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, int, _fopen, (dmfsi_context_t ctx,
         return DMFSI_ERR_INVALID;
     }
 
-    dmfsi_path_t* p = dmfsi_path_create(path);
-    if (p == NULL)
+    if (path == NULL)
+    {
+        DMOD_LOG_ERROR("dmramfs: Invalid path in fopen\n");
+        return DMFSI_ERR_INVALID;
+    }
+
+    if (ctx->read_only && (mode & (DMFSI_O_WRONLY | DMFSI_O_RDWR | DMFSI_O_CREAT | DMFSI_O_TRUNC | DMFSI_O_APPEND)))
     {
-        DMOD_LOG_ERROR("dmramfs: Invalid path in fopen: '%s'\n", path);
+        DMOD_LOG_ERROR("dmramfs: Cannot open '%s' for writing on a read-only snapshot\n", path);
         return DMFSI_ERR_INVALID;
     }
-    file_t* file = find_file(ctx->root_dir, p);
+    // Creating or truncating the file modifies the mount
+    bool modifies = (mode & (DMFSI_O_WRONLY | DMFSI_O_RDWR | DMFSI_O_CREAT | DMFSI_O_TRUNC)) != 0;
+    if (modifies)
+    {
+        rwlock_lock(&ctx->barrier, false);
+    }
+    // The file is returned write-locked
+    file_t* file = find_file(ctx, path, true);
     
     if (file == NULL)
     {
         bool can_create = (mode & DMFSI_O_CREAT) != 0 || (mode & DMFSI_O_WRONLY) != 0;
-        file = can_create ? create_file(ctx->root_dir, p) : NULL;
+        file = can_create ? create_file(ctx, path) : NULL;
         if(file == NULL)
         {
+            if (modifies)
+            {
+                rwlock_unlock(&ctx->barrier, false);
+            }
             DMOD_LOG_ERROR("dmramfs: File not found and cannot be created: '%s'\n", path);
-            dmfsi_path_free(p);
             return DMFSI_ERR_NOT_FOUND;
         }
     }
-    dmfsi_path_free(p);
 
-    file_handle_t* handle = create_file_handle(file, mode, attr);
+    file_handle_t* handle = create_file_handle(ctx, file, mode, attr);
+    rwlock_unlock(&file->lock, true);
+    if (modifies)
+    {
+        rwlock_unlock(&ctx->barrier, false);
+    }
     if (handle == NULL)
     {
         DMOD_LOG_ERROR("dmramfs: Failed to allocate memory for file handle\n");
@@ -223,12 +875,47 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, int, _fclose, (dmfsi_context_t ctx
     file_t* file = handle->file;
     
     // Remove handle from file's handle list
-    if (file && file->handles)
+    if (file)
     {
-        dmlist_remove(file->handles, handle, compare_handle_ptr);
+        rwlock_lock(&file->lock, true);
+        file_unmap(handle);
+        file_handle_t** link = &file->handles;
+        while (*link != NULL && *link != handle)
+        {
+            link = &(*link)->next;
+        }
+        if (*link != NULL)
+        {
+            *link = handle->next;
+        }
+        if (DMRAMFS_SHRINK_THRESHOLD > 0 && file->handles == NULL)
+        {
+            file_shrink(file, DMRAMFS_SHRINK_THRESHOLD);
+        }
+#if DMRAMFS_DEDUP
+        if (file->handles == NULL)
+        {
+            file_dedup(file);
+        }
+#endif
+#if DMRAMFS_COMPRESS
+        if (file->handles == NULL)
+        {
+            file->last_used = DMRAMFS_COMPRESS_CLOCK(ctx);
+            if (DMRAMFS_COMPRESS_AGE == 0)
+            {
+                file_pack(file);
+            }
+        }
+#endif
+        if (file->evictable && file->handles == NULL)
+        {
+            file_lru_insert(file);
+        }
+        rwlock_unlock(&file->lock, true);
     }
     
-    Dmod_Free(handle);
+    mount_free(ctx, handle, sizeof(file_handle_t));
     return DMFSI_OK;
 }
 
@@ -252,21 +939,16 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, int, _fread, (dmfsi_context_t ctx,
     file_handle_t* handle = (file_handle_t*)fp;
     file_t* file = handle->file;
     
-    if (file == NULL || file->data == NULL)
+    if (file == NULL)
     {
         if (read) *read = 0;
         return DMFSI_OK;  // Empty file, nothing to read
     }
     
-    // Calculate how much we can read
-    size_t available = (handle->position < file->size) ? (file->size - handle->position) : 0;
-    size_t to_read = (size < available) ? size : available;
-    
-    if (to_read > 0)
-    {
-        memcpy(buffer, (char*)file->data + handle->position, to_read);
-        handle->position += to_read;
-    }
+    rwlock_lock(&file->lock, false);
+    size_t to_read = file_read_at(file, handle->position, buffer, size);
+    rwlock_unlock(&file->lock, false);
+    handle->position += to_read;
     
     if (read) *read = to_read;
     return DMFSI_OK;
@@ -292,50 +974,26 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, int, _fwrite, (dmfsi_context_t ctx
     file_handle_t* handle = (file_handle_t*)fp;
     file_t* file = handle->file;
     
-    if (file == NULL)
+    if (file == NULL || ctx->read_only)
     {
         if (written) *written = 0;
         return DMFSI_ERR_INVALID;
     }
     
-    // Calculate new size needed
-    size_t end_position = handle->position + size;
-    
-    // Resize the file data buffer if needed
-    if (end_position > file->size)
+    int result;
+    rwlock_lock(&ctx->barrier, false);
+    do
     {
-        void* new_data = Dmod_Malloc(end_position);
-        if (new_data == NULL)
-        {
-            DMOD_LOG_ERROR("dmramfs: Failed to allocate memory for file data\n");
-            if (written) *written = 0;
-            return DMFSI_ERR_GENERAL;
-        }
-        
-        // Copy existing data if any
-        if (file->data && file->size > 0)
-        {
-            memcpy(new_data, file->data, file->size);
-        }
-        
-        // Zero-fill gap between old size and current position
-        if (handle->position > file->size)
-        {
-            memset((char*)new_data + file->size, 0, handle->position - file->size);
-        }
-        
-        // Free old data
-        if (file->data)
-        {
-            Dmod_Free(file->data);
-        }
-        
-        file->data = new_data;
-        file->size = end_position;
+        rwlock_lock(&file->lock, true);
+        result = file_write(file, handle->position, buffer, size);
+        rwlock_unlock(&file->lock, true);
+    } while (mount_make_room(ctx, result));
+    rwlock_unlock(&ctx->barrier, false);
+    if (result != DMFSI_OK)
+    {
+        if (written) *written = 0;
+        return result;
     }
-    
-    // Write the data
-    memcpy((char*)file->data + handle->position, buffer, size);
     handle->position += size;
     
     if (written) *written = size;
@@ -371,7 +1029,13 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, long, _lseek, (dmfsi_context_t ctx
             new_position = (long)handle->position + offset;
             break;
         case DMFSI_SEEK_END:
-            new_position = (file ? (long)file->size : 0) + offset;
+            new_position = offset;
+            if (file)
+            {
+                rwlock_lock(&file->lock, false);
+                new_position += (long)file->size;
+                rwlock_unlock(&file->lock, false);
+            }
             break;
         default:
             return -1;
@@ -391,16 +1055,313 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, long, _lseek, (dmfsi_context_t ctx
  */
 dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, int, _ioctl, (dmfsi_context_t ctx, void* fp, int request, void* arg) )
 {
-    // TODO: Implement ioctl
-    return DMFSI_ERR_GENERAL;
-}
+    if(dmfsi_dmramfs_context_is_valid(ctx) == 0)
+    {
+        DMOD_LOG_ERROR("dmramfs: Invalid context in ioctl\n");
+        return DMFSI_ERR_INVALID;
+    }
 
-/**
- * @brief Synchronize file data to storage
- */
-dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, int, _sync, (dmfsi_context_t ctx, void* fp) )
-{
-    // TODO: Implement sync (no-op for RAM FS)
+    file_handle_t* handle = (file_handle_t*)fp;
+    int result;
+    switch (request)
+    {
+        case DMRAMFS_IOCTL_MAP:
+            if (handle == NULL || handle->file == NULL || arg == NULL)
+            {
+                return DMFSI_ERR_INVALID;
+            }
+            rwlock_lock(&handle->file->lock, true);
+            result = file_map(handle, (dmramfs_map_t*)arg);
+            rwlock_unlock(&handle->file->lock, true);
+            return result;
+        case DMRAMFS_IOCTL_UNMAP:
+            if (handle == NULL || handle->file == NULL)
+            {
+                return DMFSI_ERR_INVALID;
+            }
+            rwlock_lock(&handle->file->lock, true);
+            file_unmap(handle);
+            rwlock_unlock(&handle->file->lock, true);
+            return DMFSI_OK;
+        case DMRAMFS_IOCTL_RESERVE:
+            if (handle == NULL || handle->file == NULL || arg == NULL || ctx->read_only)
+            {
+                return DMFSI_ERR_INVALID;
+            }
+            rwlock_lock(&ctx->barrier, false);
+            do
+            {
+                rwlock_lock(&handle->file->lock, true);
+                result = file_reserve_view(handle, (dmramfs_reserve_t*)arg);
+                rwlock_unlock(&handle->file->lock, true);
+            } while (mount_make_room(ctx, result));
+            rwlock_unlock(&ctx->barrier, false);
+            return result;
+        case DMRAMFS_IOCTL_COMMIT:
+            if (handle == NULL || handle->file == NULL || arg == NULL)
+            {
+                return DMFSI_ERR_INVALID;
+            }
+            rwlock_lock(&ctx->barrier, false);
+            rwlock_lock(&handle->file->lock, true);
+            result = file_commit(handle, *(const size_t*)arg);
+            rwlock_unlock(&handle->file->lock, true);
+            rwlock_unlock(&ctx->barrier, false);
+            return result;
+        case DMRAMFS_IOCTL_PREAD:
+        {
+            dmramfs_io_t* io = (dmramfs_io_t*)arg;
+            if (handle == NULL || handle->file == NULL || io == NULL || io->buffer == NULL)
+            {
+                return DMFSI_ERR_INVALID;
+            }
+            rwlock_lock(&handle->file->lock, false);
+            io->transferred = file_read_at(handle->file, io->offset, io->buffer, io->size);
+            rwlock_unlock(&handle->file->lock, false);
+            return DMFSI_OK;
+        }
+        case DMRAMFS_IOCTL_PWRITE:
+        {
+            dmramfs_io_t* io = (dmramfs_io_t*)arg;
+            if (handle == NULL || handle->file == NULL || io == NULL || io->buffer == NULL || ctx->read_only)
+            {
+                return DMFSI_ERR_INVALID;
+            }
+            rwlock_lock(&ctx->barrier, false);
+            do
+            {
+                rwlock_lock(&handle->file->lock, true);
+                result = file_write(handle->file, io->offset, io->buffer, io->size);
+                rwlock_unlock(&handle->file->lock, true);
+            } while (mount_make_room(ctx, result));
+            rwlock_unlock(&ctx->barrier, false);
+            io->transferred = (result == DMFSI_OK) ? io->size : 0;
+            return result;
+        }
+        case DMRAMFS_IOCTL_READV:
+        case DMRAMFS_IOCTL_WRITEV:
+        {
+            dmramfs_vector_t* vector = (dmramfs_vector_t*)arg;
+            if (handle == NULL || handle->file == NULL || vector == NULL || (vector->iov == NULL && vector->count > 0))
+            {
+                return DMFSI_ERR_INVALID;
+            }
+            bool write = (request == DMRAMFS_IOCTL_WRITEV);
+            if (write && ctx->read_only)
+            {
+                return DMFSI_ERR_INVALID;
+            }
+            if (write)
+            {
+                rwlock_lock(&ctx->barrier, false);
+            }
+            do
+            {
+                rwlock_lock(&handle->file->lock, write);
+                result = write ? file_writev(handle->file, handle->position, vector)
+                               : file_readv(handle->file, handle->position, vector);
+                rwlock_unlock(&handle->file->lock, write);
+            } while (write && mount_make_room(ctx, result));
+            if (write)
+            {
+                rwlock_unlock(&ctx->barrier, false);
+            }
+            if (result == DMFSI_OK)
+            {
+                handle->position += vector->transferred;
+            }
+            return result;
+        }
+        case DMRAMFS_IOCTL_SUBMIT:
+        case DMRAMFS_IOCTL_REAP:
+        {
+            dmramfs_batch_t* batch = (dmramfs_batch_t*)arg;
+            if (batch == NULL || (batch->ops == NULL && batch->count > 0))
+            {
+                return DMFSI_ERR_INVALID;
+            }
+            if (request == DMRAMFS_IOCTL_REAP)
+            {
+                batch->done = queue_reap(ctx, batch);
+                return DMFSI_OK;
+            }
+            batch->done = queue_submit(ctx, batch);
+            if (batch->flags & DMRAMFS_BATCH_PROCESS)
+            {
+                queue_process(ctx);
+            }
+            return DMFSI_OK;
+        }
+        case DMRAMFS_IOCTL_PROCESS:
+        {
+            size_t processed = queue_process(ctx);
+#if DMRAMFS_COMPRESS
+            // An idle pass of the worker compresses the cold files
+            counter_add(&ctx->tick);
+            if (processed == 0 && !ctx->read_only)
+            {
+                dmramfs_compress_stats_t stats;
+                mount_compress(ctx, true, &stats);
+            }
+#endif
+            if (arg != NULL)
+            {
+                *(size_t*)arg = processed;
+            }
+            return DMFSI_OK;
+        }
+        case DMRAMFS_IOCTL_CLONE:
+            if (handle == NULL || handle->file == NULL || arg == NULL || ctx->read_only)
+            {
+                return DMFSI_ERR_INVALID;
+            }
+            rwlock_lock(&ctx->barrier, false);
+            result = file_clone(ctx, handle->file, (const char*)arg);
+            rwlock_unlock(&ctx->barrier, false);
+            return result;
+        case DMRAMFS_IOCTL_SNAPSHOT:
+            if (arg == NULL)
+            {
+                return DMFSI_ERR_INVALID;
+            }
+            return mount_snapshot(ctx, (dmfsi_context_t*)arg);
+#if DMRAMFS_COMPRESS
+        case DMRAMFS_IOCTL_COMPRESS:
+        case DMRAMFS_IOCTL_COMPRESS_STATS:
+        {
+            dmramfs_compress_stats_t stats;
+            if (request == DMRAMFS_IOCTL_COMPRESS_STATS && arg == NULL)
+            {
+                return DMFSI_ERR_INVALID;
+            }
+            if (request == DMRAMFS_IOCTL_COMPRESS)
+            {
+                counter_add(&ctx->tick);
+            }
+            mount_compress(ctx, request == DMRAMFS_IOCTL_COMPRESS && !ctx->read_only, &stats);
+            if (arg != NULL)
+            {
+                *(dmramfs_compress_stats_t*)arg = stats;
+            }
+            return DMFSI_OK;
+        }
+#endif
+#if DMRAMFS_DEDUP
+        case DMRAMFS_IOCTL_DEDUP_STATS:
+            if (arg == NULL)
+            {
+                return DMFSI_ERR_INVALID;
+            }
+            dedup_stats((dmramfs_dedup_stats_t*)arg);
+            return DMFSI_OK;
+#endif
+        case DMRAMFS_IOCTL_STATFS:
+        {
+            dmramfs_statfs_t* statfs = (dmramfs_statfs_t*)arg;
+            if (statfs == NULL)
+            {
+                return DMFSI_ERR_INVALID;
+            }
+            statfs->quota_bytes = ctx->quota_bytes;
+            statfs->data_bytes = ctx->data_bytes;
+            statfs->metadata_bytes = ctx->metadata_bytes;
+            statfs->quota_inodes = ctx->quota_inodes;
+            statfs->inodes = ctx->inodes;
+            return DMFSI_OK;
+        }
+        case DMRAMFS_IOCTL_PREALLOCATE:
+        case DMRAMFS_IOCTL_TRUNCATE:
+            if (handle == NULL || handle->file == NULL || arg == NULL || ctx->read_only)
+            {
+                return DMFSI_ERR_INVALID;
+            }
+            rwlock_lock(&ctx->barrier, false);
+            do
+            {
+                rwlock_lock(&handle->file->lock, true);
+                if (request == DMRAMFS_IOCTL_PREALLOCATE)
+                {
+                    result = file_preallocate(handle->file, *(const size_t*)arg);
+                }
+                else
+                {
+                    result = file_truncate(handle->file, *(const size_t*)arg);
+                }
+                rwlock_unlock(&handle->file->lock, true);
+            } while (mount_make_room(ctx, result));
+            rwlock_unlock(&ctx->barrier, false);
+            return result;
+        case DMRAMFS_IOCTL_PUNCH_HOLE:
+        {
+            const dmramfs_range_t* range = (const dmramfs_range_t*)arg;
+            if (handle == NULL || handle->file == NULL || range == NULL || ctx->read_only)
+            {
+                return DMFSI_ERR_INVALID;
+            }
+            rwlock_lock(&ctx->barrier, false);
+            rwlock_lock(&handle->file->lock, true);
+            result = file_punch_hole(handle->file, range->offset, range->length);
+            rwlock_unlock(&handle->file->lock, true);
+            rwlock_unlock(&ctx->barrier, false);
+            return result;
+        }
+        case DMRAMFS_IOCTL_FSTAT:
+        {
+            dmramfs_fstat_t* fstat = (dmramfs_fstat_t*)arg;
+            if (handle == NULL || handle->file == NULL || fstat == NULL)
+            {
+                return DMFSI_ERR_INVALID;
+            }
+            rwlock_lock(&handle->file->lock, false);
+            fstat->size = handle->file->size;
+            fstat->allocated = file_allocated(handle->file);
+            rwlock_unlock(&handle->file->lock, false);
+            return DMFSI_OK;
+        }
+        case DMRAMFS_IOCTL_EVICTABLE:
+            if (handle == NULL || handle->file == NULL || arg == NULL || ctx->read_only)
+            {
+                return DMFSI_ERR_INVALID;
+            }
+            // The file has a handle, so it is not in the eviction list now
+            rwlock_lock(&handle->file->lock, true);
+            handle->file->evictable = *(const bool*)arg;
+            rwlock_unlock(&handle->file->lock, true);
+            return DMFSI_OK;
+        case DMRAMFS_IOCTL_SHRINK:
+        {
+            dmramfs_shrink_t* shrink = (dmramfs_shrink_t*)arg;
+            if (shrink == NULL || ctx->read_only)
+            {
+                return DMFSI_ERR_INVALID;
+            }
+            rwlock_lock(&ctx->barrier, false);
+            shrink->released = mount_evict(ctx, shrink->goal, &shrink->files);
+            rwlock_unlock(&ctx->barrier, false);
+            return DMFSI_OK;
+        }
+        case DMRAMFS_IOCTL_DCACHE_STATS:
+        {
+            dmramfs_dcache_stats_t* stats = (dmramfs_dcache_stats_t*)arg;
+            if (stats == NULL)
+            {
+                return DMFSI_ERR_INVALID;
+            }
+            stats->hits = counter_get(&ctx->dcache_hits);
+            stats->misses = counter_get(&ctx->dcache_misses);
+            return DMFSI_OK;
+        }
+        default:
+            return DMFSI_ERR_GENERAL;
+    }
+}
+
+/**
+ * @brief Synchronize file data to storage
+ */
+dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, int, _sync, (dmfsi_context_t ctx, void* fp) )
+{
+    // TODO: Implement sync (no-op for RAM FS)
     return DMFSI_OK;
 }
 
@@ -409,6 +1370,25 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, int, _sync, (dmfsi_context_t ctx,
  */
 dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, int, _getc, (dmfsi_context_t ctx, void* fp) )
 {
+    // Fast path: the handle caches the extent of the current position. The
+    // window is only set up by the validated path below, so the context and
+    // the handle do not have to be checked again for every character.
+    file_handle_t* handle = (file_handle_t*)fp;
+    if (handle != NULL && handle->file != NULL)
+    {
+        file_t* file = handle->file;
+        rwlock_lock(&file->lock, false);
+        size_t offset = handle->position - handle->window_start;
+        if (handle->window != NULL && offset < DMRAMFS_EXTENT_SIZE && handle->position < file->size)
+        {
+            int c = (int)handle->window->data[offset];
+            handle->position++;
+            rwlock_unlock(&file->lock, false);
+            return c;
+        }
+        rwlock_unlock(&file->lock, false);
+    }
+
     if(dmfsi_dmramfs_context_is_valid(ctx) == 0)
     {
         return -1;
@@ -419,16 +1399,25 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, int, _getc, (dmfsi_context_t ctx,
         return -1;
     }
     
-    file_handle_t* handle = (file_handle_t*)fp;
     file_t* file = handle->file;
     
-    if (file == NULL || file->data == NULL || handle->position >= file->size)
+    if (file == NULL)
+    {
+        return -1;
+    }
+    
+    rwlock_lock(&file->lock, false);
+    if (handle->position >= file->size)
     {
+        rwlock_unlock(&file->lock, false);
         return -1;  // EOF
     }
     
-    unsigned char c = ((unsigned char*)file->data)[handle->position];
+    handle_set_window(handle);
+    const unsigned char* data = file_data_at(file, handle->position, NULL);
+    unsigned char c = (data != NULL) ? *data : 0;
     handle->position++;
+    rwlock_unlock(&file->lock, false);
     return (int)c;
 }
 
@@ -437,26 +1426,62 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, int, _getc, (dmfsi_context_t ctx,
  */
 dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, int, _putc, (dmfsi_context_t ctx, void* fp, int c) )
 {
+    // Fast path: store directly into the cached extent as long as the write
+    // does not leave a gap behind the end of file and the extent is not shared.
+    // The context is not validated yet, so the mount of the file is used.
+    file_handle_t* handle = (file_handle_t*)fp;
+    if (handle != NULL && handle->file != NULL)
+    {
+        file_t* file = handle->file;
+        dmfsi_context_t mount = file->mount;
+        rwlock_lock(&mount->barrier, false);
+        rwlock_lock(&file->lock, true);
+        size_t offset = handle->position - handle->window_start;
+        if (handle->window != NULL && offset < DMRAMFS_EXTENT_SIZE && handle->position <= file->size
+            && file->pins == 0 && handle->window->refs == 1 && !mount->read_only)
+        {
+            handle->window->data[offset] = (unsigned char)c;
+            if (++handle->position > file->size)
+            {
+                file->size = handle->position;
+            }
+            rwlock_unlock(&file->lock, true);
+            rwlock_unlock(&mount->barrier, false);
+            return c;
+        }
+        rwlock_unlock(&file->lock, true);
+        rwlock_unlock(&mount->barrier, false);
+    }
+
     if(dmfsi_dmramfs_context_is_valid(ctx) == 0)
     {
         return -1;
     }
     
-    if (fp == NULL)
+    if (fp == NULL || handle->file == NULL || ctx->read_only)
     {
         return -1;
     }
     
+    file_t* file = handle->file;
     unsigned char ch = (unsigned char)c;
-    size_t written = 0;
     
-    int ret = dmfsi_dmramfs_fwrite(ctx, fp, &ch, 1, &written);
-    if (ret != DMFSI_OK || written != 1)
+    int ret;
+    rwlock_lock(&ctx->barrier, false);
+    do
     {
-        return -1;
-    }
-    
-    return c;
+        rwlock_lock(&file->lock, true);
+        ret = file_write(file, handle->position, &ch, 1);
+        if (ret == DMFSI_OK)
+        {
+            handle->position++;
+            // Cache the extent, so the following characters take the fast path
+            handle_set_window(handle);
+        }
+        rwlock_unlock(&file->lock, true);
+    } while (mount_make_room(ctx, ret));
+    rwlock_unlock(&ctx->barrier, false);
+    return (ret == DMFSI_OK) ? c : -1;
 }
 
 /**
@@ -501,7 +1526,10 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, int, _eof, (dmfsi_context_t ctx, v
         return 1;  // Empty file is at EOF
     }
     
-    return (handle->position >= file->size) ? 1 : 0;
+    rwlock_lock(&file->lock, false);
+    int eof = (handle->position >= file->size) ? 1 : 0;
+    rwlock_unlock(&file->lock, false);
+    return eof;
 }
 
 /**
@@ -527,7 +1555,10 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, long, _size, (dmfsi_context_t ctx,
         return 0;
     }
     
-    return (long)file->size;
+    rwlock_lock(&file->lock, false);
+    long size = (long)file->size;
+    rwlock_unlock(&file->lock, false);
+    return size;
 }
 
 /**
@@ -564,65 +1595,25 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, int, _opendir, (dmfsi_context_t ct
         return DMFSI_ERR_INVALID;
     }
     
-    dir_t* dir = NULL;
-    
-    // Handle root directory case
-    if (path == NULL || strcmp(path, "/") == 0 || strcmp(path, "") == 0)
-    {
-        dir = ctx->root_dir;
-    }
-    else
-    {
-        // Remove leading slash if present
-        const char* search_path = path;
-        if (search_path[0] == '/')
-        {
-            search_path++;
-        }
-        
-        // Remove trailing slash if present
-        size_t len = strlen(search_path);
-        char* clean_path = dmfsi_strndup(search_path, len);
-        if (clean_path == NULL)
-        {
-            return DMFSI_ERR_GENERAL;
-        }
-        
-        if (len > 0 && clean_path[len - 1] == '/')
-        {
-            clean_path[len - 1] = '\0';
-        }
-        
-        if (strlen(clean_path) == 0)
-        {
-            dir = ctx->root_dir;
-        }
-        else
-        {
-            dmfsi_path_t* p = dmfsi_path_create(clean_path);
-            if (p != NULL)
-            {
-                dir = find_dir(ctx->root_dir, p);
-                dmfsi_path_free(p);
-            }
-        }
-        Dmod_Free(clean_path);
-    }
-    
+    // NULL path is the root directory
+    dir_t* dir = (path == NULL) ? ctx->root_dir : find_dir(ctx, path);
     if (dir == NULL)
     {
         return DMFSI_ERR_NOT_FOUND;
     }
     
-    dir_handle_t* handle = Dmod_Malloc(sizeof(dir_handle_t));
+    dir_handle_t* handle = mount_alloc(ctx, sizeof(dir_handle_t));
     if (handle == NULL)
     {
         return DMFSI_ERR_GENERAL;
     }
     
+    rwlock_lock(&dir->lock, true);
     handle->dir = dir;
-    handle->file_index = 0;
-    handle->dir_index = 0;
+    handle->cursor = dir->first_child;
+    handle->next = dir->handles;
+    dir->handles = handle;
+    rwlock_unlock(&dir->lock, true);
     
     *dp = handle;
     return DMFSI_OK;
@@ -644,7 +1635,21 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, int, _closedir, (dmfsi_context_t c
     }
     
     dir_handle_t* handle = (dir_handle_t*)dp;
-    Dmod_Free(handle);
+    if (handle->dir != NULL)
+    {
+        rwlock_lock(&handle->dir->lock, true);
+        dir_handle_t** link = &handle->dir->handles;
+        while (*link != NULL && *link != handle)
+        {
+            link = &(*link)->next;
+        }
+        if (*link != NULL)
+        {
+            *link = handle->next;
+        }
+        rwlock_unlock(&handle->dir->lock, true);
+    }
+    mount_free(ctx, handle, sizeof(dir_handle_t));
     return DMFSI_OK;
 }
 
@@ -671,42 +1676,34 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, int, _readdir, (dmfsi_context_t ct
         return DMFSI_ERR_NOT_FOUND;
     }
     
-    // First iterate through files
-    size_t file_count = dmlist_size(dir->files);
-    if (handle->file_index < file_count)
+    rwlock_lock(&dir->lock, false);
+    entry_t* child = handle->cursor;
+    if (child == NULL)
     {
-        file_t* file = (file_t*)dmlist_get(dir->files, handle->file_index);
-        if (file != NULL)
-        {
-            strncpy(entry->name, file->file_name, sizeof(entry->name) - 1);
-            entry->name[sizeof(entry->name) - 1] = '\0';
-            entry->size = (uint32_t)file->size;
-            entry->attr = 0;  // Regular file
-            entry->time = 0;
-            handle->file_index++;
-            return DMFSI_OK;
-        }
+        // No more entries
+        rwlock_unlock(&dir->lock, false);
+        return DMFSI_ERR_NOT_FOUND;
     }
+    handle->cursor = child->next_sibling;
     
-    // Then iterate through subdirectories
-    size_t dir_count = dmlist_size(dir->dirs);
-    if (handle->dir_index < dir_count)
+    strncpy(entry->name, child->name, sizeof(entry->name) - 1);
+    entry->name[sizeof(entry->name) - 1] = '\0';
+    if (child->is_dir)
     {
-        dir_t* subdir = (dir_t*)dmlist_get(dir->dirs, handle->dir_index);
-        if (subdir != NULL)
-        {
-            strncpy(entry->name, subdir->dir_name, sizeof(entry->name) - 1);
-            entry->name[sizeof(entry->name) - 1] = '\0';
-            entry->size = 0;
-            entry->attr = 0x10;  // Directory attribute
-            entry->time = 0;
-            handle->dir_index++;
-            return DMFSI_OK;
-        }
+        entry->size = 0;
+        entry->attr = 0x10;  // Directory attribute
     }
-    
-    // No more entries
-    return DMFSI_ERR_NOT_FOUND;
+    else
+    {
+        file_t* file = (file_t*)child;
+        rwlock_lock(&file->lock, false);
+        entry->size = (uint32_t)file->size;
+        rwlock_unlock(&file->lock, false);
+        entry->attr = 0;  // Regular file
+    }
+    rwlock_unlock(&dir->lock, false);
+    entry->time = 0;
+    return DMFSI_OK;
 }
 
 /**
@@ -725,45 +1722,21 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, int, _stat, (dmfsi_context_t ctx,
         return DMFSI_ERR_INVALID;
     }
     
-    // Remove leading slash if present
-    const char* search_path = path;
-    if (search_path[0] == '/')
-    {
-        search_path++;
-    }
-    
-    if (strlen(search_path) == 0)
-    {
-        // Root directory stat
-        stat->size = 0;
-        stat->attr = 0x10;  // Directory
-        stat->ctime = 0;
-        stat->mtime = 0;
-        stat->atime = 0;
-        return DMFSI_OK;
-    }
-    
-    dmfsi_path_t* p = dmfsi_path_create(search_path);
-    if (p == NULL)
-    {
-        return DMFSI_ERR_INVALID;
-    }
-    
     // Try to find as file first
-    file_t* file = find_file(ctx->root_dir, p);
+    file_t* file = find_file(ctx, path, false);
     if (file != NULL)
     {
         stat->size = (uint32_t)file->size;
+        rwlock_unlock(&file->lock, false);
         stat->attr = 0;  // Regular file
         stat->ctime = 0;
         stat->mtime = 0;
         stat->atime = 0;
-        dmfsi_path_free(p);
         return DMFSI_OK;
     }
     
-    // Try to find as directory
-    dir_t* dir = find_dir(ctx->root_dir, p);
+    // Try to find as directory (including the root directory)
+    dir_t* dir = find_dir(ctx, path);
     if (dir != NULL)
     {
         stat->size = 0;
@@ -771,11 +1744,9 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, int, _stat, (dmfsi_context_t ctx,
         stat->ctime = 0;
         stat->mtime = 0;
         stat->atime = 0;
-        dmfsi_path_free(p);
         return DMFSI_OK;
     }
     
-    dmfsi_path_free(p);
     return DMFSI_ERR_NOT_FOUND;
 }
 
@@ -790,68 +1761,55 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, int, _unlink, (dmfsi_context_t ctx
         return DMFSI_ERR_INVALID;
     }
     
-    if (path == NULL)
-    {
-        return DMFSI_ERR_INVALID;
-    }
-    
-    // Remove leading slash if present
-    const char* search_path = path;
-    if (search_path[0] == '/')
-    {
-        search_path++;
-    }
-    
-    dmfsi_path_t* p = dmfsi_path_create(search_path);
-    if (p == NULL)
+    if (path == NULL || ctx->read_only)
     {
         return DMFSI_ERR_INVALID;
     }
     
     // Find the parent directory and file
-    dir_t* parent_dir = ctx->root_dir;
-    dmfsi_path_t* current = p;
-    
-    // Navigate to parent directory
-    while (current->directory != NULL && current->next != NULL)
-    {
-        dir_t* subdir = dmlist_find(parent_dir->dirs, current->directory, compare_dir_name);
-        if (subdir == NULL)
-        {
-            dmfsi_path_free(p);
-            return DMFSI_ERR_NOT_FOUND;
-        }
-        parent_dir = subdir;
-        current = current->next;
-    }
-    
-    // Find and remove the file
-    const char* filename = (current->filename != NULL) ? current->filename : current->directory;
-    if (filename == NULL)
+    rwlock_lock(&ctx->barrier, false);
+    path_component_t filename;
+    unsigned reader = epoch_enter(ctx);
+    dir_t* parent_dir = resolve_parent(ctx, path, &filename);
+    epoch_exit(ctx, reader);
+    if (parent_dir == NULL || filename.len == 0)
     {
-        dmfsi_path_free(p);
+        rwlock_unlock(&ctx->barrier, false);
         return DMFSI_ERR_NOT_FOUND;
     }
     
-    file_t* file = dmlist_find(parent_dir->files, filename, compare_file_name);
+    rwlock_lock(&parent_dir->lock, true);
+    file_t* file = (file_t*)index_find(&parent_dir->children, filename.name, filename.len, false);
     if (file == NULL)
     {
-        dmfsi_path_free(p);
+        rwlock_unlock(&parent_dir->lock, true);
+        rwlock_unlock(&ctx->barrier, false);
         return DMFSI_ERR_NOT_FOUND;
     }
     
-    // Check if file has open handles
-    if (file->handles && dmlist_size(file->handles) > 0)
+    // Wait for the users of the file and mark it, so lookups racing with
+    // the removal do not use it
+    rwlock_lock(&file->lock, true);
+    bool in_use = (file->handles != NULL);
+    if (!in_use)
+    {
+        file->unlinked = true;
+    }
+    rwlock_unlock(&file->lock, true);
+    if (in_use)
     {
-        dmfsi_path_free(p);
+        rwlock_unlock(&parent_dir->lock, true);
+        rwlock_unlock(&ctx->barrier, false);
         return DMFSI_ERR_INVALID;  // File is in use
     }
     
-    // Remove from list and free
-    dmlist_remove(parent_dir->files, file, compare_file_ptr);
-    free_file(file);
+    // Remove from the cache and the directory and free
+    dcache_forget(ctx, &file->entry);
+    dir_remove_child(ctx, parent_dir, &file->entry);
+    rwlock_unlock(&parent_dir->lock, true);
+    free_file(ctx, file);
+    rwlock_unlock(&ctx->barrier, false);
     
-    dmfsi_path_free(p);
     return DMFSI_OK;
 }
 
@@ -866,67 +1824,107 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, int, _rename, (dmfsi_context_t ctx
         return DMFSI_ERR_INVALID;
     }
     
-    if (oldpath == NULL || newpath == NULL)
+    if (oldpath == NULL || newpath == NULL || ctx->read_only)
     {
         return DMFSI_ERR_INVALID;
     }
     
-    // Remove leading slashes
-    const char* old_search = (oldpath[0] == '/') ? oldpath + 1 : oldpath;
-    const char* new_search = (newpath[0] == '/') ? newpath + 1 : newpath;
-    
-    dmfsi_path_t* old_p = dmfsi_path_create(old_search);
-    if (old_p == NULL)
+    // Find the file (the directory stays locked for the whole rename)
+    rwlock_lock(&ctx->barrier, false);
+    path_component_t old_name;
+    unsigned reader = epoch_enter(ctx);
+    dir_t* dir = resolve_parent(ctx, oldpath, &old_name);
+    epoch_exit(ctx, reader);
+    if (dir == NULL || old_name.len == 0)
     {
-        return DMFSI_ERR_INVALID;
+        rwlock_unlock(&ctx->barrier, false);
+        return DMFSI_ERR_NOT_FOUND;
     }
-    
-    // Find the file
-    file_t* file = find_file(ctx->root_dir, old_p);
+    rwlock_lock(&dir->lock, true);
+    file_t* file = (file_t*)index_find(&dir->children, old_name.name, old_name.len, false);
     if (file == NULL)
     {
-        dmfsi_path_free(old_p);
+        rwlock_unlock(&dir->lock, true);
+        rwlock_unlock(&ctx->barrier, false);
         return DMFSI_ERR_NOT_FOUND;
     }
     
     // Extract just the filename from the new path
-    dmfsi_path_t* new_p = dmfsi_path_create(new_search);
-    if (new_p == NULL)
+    path_component_t new_name = { NULL, 0 };
+    path_component_t component;
+    while (path_next(&newpath, &component))
+    {
+        new_name = component;
+    }
+    if (new_name.len == 0)
     {
-        dmfsi_path_free(old_p);
+        rwlock_unlock(&dir->lock, true);
+        rwlock_unlock(&ctx->barrier, false);
         return DMFSI_ERR_INVALID;
     }
-    
-    // Find the new filename (traverse to the end)
-    dmfsi_path_t* current = new_p;
-    while (current->next != NULL)
+    file_t* target = (file_t*)index_find(&dir->children, new_name.name, new_name.len, false);
+    if (target == file)
     {
-        current = current->next;
+        rwlock_unlock(&dir->lock, true);
+        rwlock_unlock(&ctx->barrier, false);
+        return DMFSI_OK;
     }
     
-    const char* new_name = (current->filename != NULL) ? current->filename : current->directory;
-    if (new_name == NULL)
+    // Update the filename - lock-free lookups may be reading the buffer in
+    // the node, so the new name is always allocated. The index gets room for
+    // the new name before the old one is removed, so a failure leaves the
+    // file untouched.
+    dir_index_t* index = &dir->children;
+    char* name = mount_strndup(ctx, new_name.name, new_name.len);
+    if (name == NULL || index_reserve(ctx, index) != DMFSI_OK)
     {
-        dmfsi_path_free(old_p);
-        dmfsi_path_free(new_p);
-        return DMFSI_ERR_INVALID;
+        mount_free_string(ctx, name);
+        rwlock_unlock(&dir->lock, true);
+        rwlock_unlock(&ctx->barrier, false);
+        DMOD_LOG_ERROR("dmramfs: Failed to allocate memory for rename\n");
+        return DMFSI_ERR_GENERAL;
     }
     
-    // Update the filename
-    char* old_name = file->file_name;
-    file->file_name = dmfsi_strndup(new_name, strlen(new_name));
-    if (file->file_name == NULL)
+    // An existing file with the new name is replaced the same way _unlink
+    // removes it, unless it is open
+    if (target != NULL)
     {
-        file->file_name = old_name;  // Restore on failure
-        dmfsi_path_free(old_p);
-        dmfsi_path_free(new_p);
-        return DMFSI_ERR_GENERAL;
+        rwlock_lock(&target->lock, true);
+        bool in_use = (target->handles != NULL);
+        if (!in_use)
+        {
+            target->unlinked = true;
+        }
+        rwlock_unlock(&target->lock, true);
+        if (in_use)
+        {
+            mount_free_string(ctx, name);
+            rwlock_unlock(&dir->lock, true);
+            rwlock_unlock(&ctx->barrier, false);
+            return DMFSI_ERR_INVALID;  // File is in use
+        }
+        dcache_forget(ctx, &target->entry);
+        dir_remove_child(ctx, dir, &target->entry);
     }
     
-    Dmod_Free(old_name);
-    dmfsi_path_free(old_p);
-    dmfsi_path_free(new_p);
-    return DMFSI_OK;
+    // Re-index the file under its new name (cannot fail after index_reserve).
+    // Lock-free lookups may still read the old name, so it is retired rather
+    // than freed.
+    char* old = file->entry.name;
+    dcache_forget(ctx, &file->entry);
+    index_remove(ctx, index, &file->entry);
+    if (old != file->entry.short_name)
+    {
+        epoch_retire(ctx, old, strlen(old) + 1);
+    }
+    file->entry.name = name;
+    file->entry.name_len = (new_name.len < DMRAMFS_NAME_LEN_LONG) ? (uint8_t)new_name.len : DMRAMFS_NAME_LEN_LONG;
+    file->entry.hash = name_hash(new_name.name, new_name.len);
+    int result = index_insert(ctx, index, &file->entry);
+    rwlock_unlock(&dir->lock, true);
+    free_file(ctx, target);
+    rwlock_unlock(&ctx->barrier, false);
+    return result;
 }
 
 /**
@@ -946,31 +1944,13 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, int, _chmod, (dmfsi_context_t ctx,
         return DMFSI_ERR_INVALID;
     }
     
-    // Remove leading slash if present
-    const char* search_path = path;
-    if (search_path[0] == '/')
-    {
-        search_path++;
-    }
-    
-    if (strlen(search_path) == 0)
-    {
-        return DMFSI_OK;  // Root directory
-    }
-    
-    dmfsi_path_t* p = dmfsi_path_create(search_path);
-    if (p == NULL)
+    // Check if file or directory exists
+    file_t* file = find_file(ctx, path, false);
+    if (file != NULL)
     {
-        return DMFSI_ERR_INVALID;
+        rwlock_unlock(&file->lock, false);
     }
-    
-    // Check if file or directory exists
-    file_t* file = find_file(ctx->root_dir, p);
-    dir_t* dir = (file == NULL) ? find_dir(ctx->root_dir, p) : NULL;
-    
-    dmfsi_path_free(p);
-    
-    if (file == NULL && dir == NULL)
+    else if (find_dir(ctx, path) == NULL)
     {
         return DMFSI_ERR_NOT_FOUND;
     }
@@ -995,31 +1975,13 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, int, _utime, (dmfsi_context_t ctx,
         return DMFSI_ERR_INVALID;
     }
     
-    // Remove leading slash if present
-    const char* search_path = path;
-    if (search_path[0] == '/')
-    {
-        search_path++;
-    }
-    
-    if (strlen(search_path) == 0)
-    {
-        return DMFSI_OK;  // Root directory
-    }
-    
-    dmfsi_path_t* p = dmfsi_path_create(search_path);
-    if (p == NULL)
+    // Check if file or directory exists
+    file_t* file = find_file(ctx, path, false);
+    if (file != NULL)
     {
-        return DMFSI_ERR_INVALID;
+        rwlock_unlock(&file->lock, false);
     }
-    
-    // Check if file or directory exists
-    file_t* file = find_file(ctx->root_dir, p);
-    dir_t* dir = (file == NULL) ? find_dir(ctx->root_dir, p) : NULL;
-    
-    dmfsi_path_free(p);
-    
-    if (file == NULL && dir == NULL)
+    else if (find_dir(ctx, path) == NULL)
     {
         return DMFSI_ERR_NOT_FOUND;
     }
@@ -1038,42 +2000,21 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, int, _mkdir, (dmfsi_context_t ctx,
         return DMFSI_ERR_INVALID;
     }
     
-    if (path == NULL)
+    if (path == NULL || ctx->read_only)
     {
         return DMFSI_ERR_INVALID;
     }
     
-    // Remove leading slash if present
-    const char* search_path = path;
-    if (search_path[0] == '/')
+    // Create the directory (returns the existing one if already there)
+    rwlock_lock(&ctx->barrier, false);
+    dir_t* new_dir = create_dir(ctx, path);
+    rwlock_unlock(&ctx->barrier, false);
+    if (new_dir == ctx->root_dir)
     {
-        search_path++;
+        return DMFSI_ERR_INVALID;  // Can't create root
     }
     
-    if (strlen(search_path) == 0)
-    {
-        return DMFSI_ERR_INVALID;  // Can't create root
-    }
-    
-    dmfsi_path_t* p = dmfsi_path_create(search_path);
-    if (p == NULL)
-    {
-        return DMFSI_ERR_INVALID;
-    }
-    
-    // Check if already exists
-    dir_t* existing = find_dir(ctx->root_dir, p);
-    if (existing != NULL)
-    {
-        dmfsi_path_free(p);
-        return DMFSI_OK;  // Already exists
-    }
-    
-    // Create the directory
-    dir_t* new_dir = create_dir(ctx->root_dir, p);
-    dmfsi_path_free(p);
-    
-    if (new_dir == NULL)
+    if (new_dir == NULL)
     {
         return DMFSI_ERR_GENERAL;
     }
@@ -1096,479 +2037,3686 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmramfs, int, _direxists, (dmfsi_context_t
         return 0;
     }
     
-    // Handle root directory
-    if (strcmp(path, "/") == 0 || strcmp(path, "") == 0)
+    return (find_dir(ctx, path) != NULL) ? 1 : 0;
+}
+
+// ============================================================================
+//                      Local Functions
+// ============================================================================
+
+/**
+ * @brief Acquire a reader/writer lock
+ * 
+ * Waiting writers block new readers, so a steady stream of readers cannot
+ * starve them. The locks are not recursive.
+ * 
+ * @param lock       The lock to acquire
+ * @param exclusive  true to lock for writing, false to lock for reading
+ */
+static void rwlock_lock(rwlock_t* lock, bool exclusive)
+{
+#if DMRAMFS_THREAD_SAFE
+    unsigned spins = 0;
+    while (true)
+    {
+        unsigned state = atomic_load_explicit(&lock->state, memory_order_relaxed);
+        if (!exclusive)
+        {
+            if ((state & (DMRAMFS_RWLOCK_WRITER | DMRAMFS_RWLOCK_PENDING)) == 0
+                && atomic_compare_exchange_weak_explicit(&lock->state, &state, state + 1,
+                                                         memory_order_acquire, memory_order_relaxed))
+            {
+                return;
+            }
+        }
+        else if ((state & ~DMRAMFS_RWLOCK_PENDING) == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&lock->state, &state, DMRAMFS_RWLOCK_WRITER,
+                                                      memory_order_acquire, memory_order_relaxed))
+            {
+                return;
+            }
+        }
+        else if ((state & DMRAMFS_RWLOCK_PENDING) == 0)
+        {
+            atomic_compare_exchange_weak_explicit(&lock->state, &state, state | DMRAMFS_RWLOCK_PENDING,
+                                                  memory_order_relaxed, memory_order_relaxed);
+        }
+        lock_relax(&spins);
+    }
+#else
+    (void)lock;
+    (void)exclusive;
+#endif
+}
+
+#if DMRAMFS_THREAD_SAFE
+/**
+ * @brief Wait for another task in a lock loop
+ * 
+ * Spins DMRAMFS_LOCK_SPINS times, then yields the CPU on every call.
+ * 
+ * @param spins  Iterations of the loop so far (starting at 0)
+ */
+static void lock_relax(unsigned* spins)
+{
+    if (*spins < DMRAMFS_LOCK_SPINS)
+    {
+        (*spins)++;
+        return;
+    }
+    DMRAMFS_LOCK_RELAX();
+}
+#endif
+
+/**
+ * @brief Release a reader/writer lock
+ * 
+ * @param lock       The lock to release
+ * @param exclusive  Must match the mode the lock was acquired in
+ */
+static void rwlock_unlock(rwlock_t* lock, bool exclusive)
+{
+#if DMRAMFS_THREAD_SAFE
+    if (exclusive)
+    {
+        // Keeps the PENDING bit set by another waiting writer
+        atomic_fetch_and_explicit(&lock->state, ~DMRAMFS_RWLOCK_WRITER, memory_order_release);
+    }
+    else
+    {
+        atomic_fetch_sub_explicit(&lock->state, 1, memory_order_release);
+    }
+#else
+    (void)lock;
+    (void)exclusive;
+#endif
+}
+
+/**
+ * @brief Lock the lock for writing if it is free, without waiting
+ * 
+ * Used where the lock order cannot be respected, so giving up replaces
+ * waiting for a lock that may be held by the caller.
+ * 
+ * @return bool  true if the lock was taken
+ */
+static bool rwlock_try_lock(rwlock_t* lock)
+{
+#if DMRAMFS_THREAD_SAFE
+    unsigned state = 0;
+    return atomic_compare_exchange_strong_explicit(&lock->state, &state, DMRAMFS_RWLOCK_WRITER,
+                                                   memory_order_acquire, memory_order_relaxed);
+#else
+    (void)lock;
+    return true;
+#endif
+}
+
+/**
+ * @brief Increment a statistics counter
+ */
+static void counter_add(counter_t* counter)
+{
+#if DMRAMFS_THREAD_SAFE
+    atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+#else
+    (*counter)++;
+#endif
+}
+
+/**
+ * @brief Read a statistics counter
+ */
+static uint32_t counter_get(counter_t* counter)
+{
+#if DMRAMFS_THREAD_SAFE
+    return atomic_load_explicit(counter, memory_order_relaxed);
+#else
+    return *counter;
+#endif
+}
+
+/**
+ * @brief Enter a lock-free section
+ * 
+ * Until epoch_exit, the objects reachable from the tree (directory tables,
+ * names and files) are not released, even if they are unlinked meanwhile.
+ * Sections must be short and cannot be nested.
+ * 
+ * @param ctx  The file system context
+ * 
+ * @return unsigned  The reader slot to pass to epoch_exit
+ */
+static unsigned epoch_enter(dmfsi_context_t ctx)
+{
+#if DMRAMFS_THREAD_SAFE
+    unsigned spins = 0;
+    while (true)
+    {
+        for (unsigned i = 0; i < DMRAMFS_EPOCH_READERS; i++)
+        {
+            uint32_t expected = 0;
+            uint32_t epoch = ctx->epoch;
+            if (ctx->epoch_readers[i] == 0
+                && atomic_compare_exchange_strong(&ctx->epoch_readers[i], &expected, epoch | DMRAMFS_EPOCH_ACTIVE))
+            {
+                // The epoch may have advanced before the slot was claimed
+                while ((epoch = ctx->epoch) != (ctx->epoch_readers[i] & ~DMRAMFS_EPOCH_ACTIVE))
+                {
+                    ctx->epoch_readers[i] = epoch | DMRAMFS_EPOCH_ACTIVE;
+                }
+                return i;
+            }
+        }
+        lock_relax(&spins);
+    }
+#else
+    (void)ctx;
+    return 0;
+#endif
+}
+
+/**
+ * @brief Leave a lock-free section
+ */
+static void epoch_exit(dmfsi_context_t ctx, unsigned reader)
+{
+#if DMRAMFS_THREAD_SAFE
+    ctx->epoch_readers[reader] = 0;
+#else
+    (void)ctx;
+    (void)reader;
+#endif
+}
+
+#if DMRAMFS_THREAD_SAFE
+/**
+ * @brief Advance the epoch if all active readers have seen the current one
+ * 
+ * Must be called with the retire lock held.
+ */
+static void epoch_try_advance(dmfsi_context_t ctx)
+{
+    uint32_t epoch = ctx->epoch;
+    for (unsigned i = 0; i < DMRAMFS_EPOCH_READERS; i++)
+    {
+        uint32_t reader = ctx->epoch_readers[i];
+        if ((reader & DMRAMFS_EPOCH_ACTIVE) && (reader & ~DMRAMFS_EPOCH_ACTIVE) != epoch)
+        {
+            return;
+        }
+    }
+    ctx->epoch = (epoch + 1) & ~DMRAMFS_EPOCH_ACTIVE;
+}
+
+/**
+ * @brief Number of epochs passed since the given one
+ */
+static uint32_t epoch_age(dmfsi_context_t ctx, uint32_t epoch)
+{
+    return (ctx->epoch - epoch) & ~DMRAMFS_EPOCH_ACTIVE;
+}
+#endif
+
+/**
+ * @brief Free an unlinked object once no lock-free reader can see it
+ * 
+ * Objects retired in an epoch are released when the epoch has advanced
+ * twice. Must not be called inside a lock-free section or with a file lock held.
+ * 
+ * @param ctx   The file system context
+ * @param ptr   The object (allocated with mount_alloc)
+ * @param size  The size the object was allocated with
+ */
+static void epoch_retire(dmfsi_context_t ctx, void* ptr, size_t size)
+{
+#if DMRAMFS_THREAD_SAFE
+    // Retiring frees memory, so the quota must not make it wait for the readers
+    retired_t* node = mount_alloc_object(ctx, sizeof(retired_t), false);
+    rwlock_lock(&ctx->retire_lock, true);
+    if (node == NULL)
+    {
+        // Out of memory - wait for the readers instead
+        uint32_t epoch = ctx->epoch;
+        unsigned spins = 0;
+        while (epoch_age(ctx, epoch) < 2)
+        {
+            epoch_try_advance(ctx);
+            lock_relax(&spins);
+        }
+        rwlock_unlock(&ctx->retire_lock, true);
+        mount_free(ctx, ptr, size);
+        return;
+    }
+    node->ptr = ptr;
+    node->size = size;
+    node->epoch = ctx->epoch;
+    node->next = ctx->retired;
+    ctx->retired = node;
+    epoch_try_advance(ctx);
+
+    // Detach the objects no reader can see anymore
+    retired_t* ready = NULL;
+    retired_t** link = &ctx->retired;
+    while (*link != NULL)
+    {
+        retired_t* retired = *link;
+        if (epoch_age(ctx, retired->epoch) >= 2)
+        {
+            *link = retired->next;
+            retired->next = ready;
+            ready = retired;
+        }
+        else
+        {
+            link = &retired->next;
+        }
+    }
+    rwlock_unlock(&ctx->retire_lock, true);
+
+    while (ready != NULL)
+    {
+        retired_t* next = ready->next;
+        mount_free(ctx, ready->ptr, ready->size);
+        mount_free(ctx, ready, sizeof(retired_t));
+        ready = next;
+    }
+#else
+    mount_free(ctx, ptr, size);
+#endif
+}
+
+/**
+ * @brief Free all retired objects (the mount must not be in use)
+ */
+static void epoch_release(dmfsi_context_t ctx)
+{
+    while (ctx->retired != NULL)
+    {
+        retired_t* retired = ctx->retired;
+        ctx->retired = retired->next;
+        mount_free(ctx, retired->ptr, retired->size);
+        mount_free(ctx, retired, sizeof(retired_t));
+    }
+}
+
+/**
+ * @brief Calculate the hash of a name (FNV-1a)
+ * 
+ * @param name  The name to hash
+ * @param len   The length of the name
+ * 
+ * @return uint32_t  The hash of the name
+ */
+static uint32_t name_hash(const char* name, size_t len)
+{
+    return hash_bytes(DMRAMFS_HASH_SEED, name, len);
+}
+
+/**
+ * @brief Continue an FNV-1a hash over the given bytes
+ * 
+ * @param hash  The hash calculated so far (DMRAMFS_HASH_SEED to start)
+ * @param data  The bytes to hash
+ * @param len   The number of bytes
+ * 
+ * @return uint32_t  The updated hash
+ */
+static uint32_t hash_bytes(uint32_t hash, const char* data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (uint8_t)data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief Marker object pointed to by removed index slots
+ */
+static const entry_t index_tombstone;
+
+/**
+ * @brief Look for an entry in a single table of the index
+ */
+static entry_t* index_table_find(const index_table_t* table, const char* name, size_t len, uint32_t hash, bool is_dir)
+{
+    if (table == NULL)
+    {
+        return NULL;
+    }
+
+    size_t mask = table->capacity - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask)
+    {
+        entry_t* entry = table->slots[i].entry;
+        if (entry == NULL)
+        {
+            return NULL;
+        }
+        if (entry != DMRAMFS_INDEX_TOMBSTONE && table->slots[i].hash == hash && entry->is_dir == is_dir
+            && entry_name_is(entry, name, len))
+        {
+            return entry;
+        }
+    }
+}
+
+/**
+ * @brief Store an entry in the first free slot of a table
+ * 
+ * @return bool  true if an empty (never used) slot was consumed
+ */
+static bool index_table_put(index_table_t* table, entry_t* entry)
+{
+    size_t mask = table->capacity - 1;
+    size_t i = entry->hash & mask;
+    while (table->slots[i].entry != NULL && table->slots[i].entry != DMRAMFS_INDEX_TOMBSTONE)
+    {
+        i = (i + 1) & mask;
+    }
+    bool was_empty = (table->slots[i].entry == NULL);
+    table->slots[i].hash = entry->hash;
+    table->slots[i].entry = entry;
+    return was_empty;
+}
+
+/**
+ * @brief Move up to the given number of slots from the old table to the new one
+ * 
+ * An entry is stored in the new table before it is removed from the old
+ * one, so a reader checking the old table first never misses it.
+ */
+static void index_migrate(dmfsi_context_t ctx, dir_index_t* index, size_t step)
+{
+    index_table_t* table = index->table;
+    index_table_t* old = (table != NULL) ? table->old : NULL;
+    while (old != NULL && step-- > 0)
+    {
+        index_slot_t* slot = &old->slots[index->migrated++];
+        entry_t* entry = slot->entry;
+        if (entry != NULL && entry != DMRAMFS_INDEX_TOMBSTONE)
+        {
+            if (index_table_put(table, entry))
+            {
+                index->used++;
+            }
+            // Keep the probe chains of the old table intact
+            slot->entry = DMRAMFS_INDEX_TOMBSTONE;
+        }
+        if (index->migrated == old->capacity)
+        {
+            table->old = NULL;
+            epoch_retire(ctx, old, DMRAMFS_INDEX_TABLE_SIZE(old->capacity));
+            old = NULL;
+            index->migrated = 0;
+        }
+    }
+}
+
+/**
+ * @brief Find an entry in a directory index
+ * 
+ * Safe without the directory lock inside an epoch (see epoch_enter).
+ * 
+ * @param index   The index to search
+ * @param name    The name to look for (does not need to be NUL terminated)
+ * @param len     The length of the name
+ * @param is_dir  true to look for a directory, false to look for a file
+ * 
+ * @return entry_t*  The entry, or NULL if not found
+ */
+static entry_t* index_find(const dir_index_t* index, const char* name, size_t len, bool is_dir)
+{
+    uint32_t hash = name_hash(name, len);
+    index_table_t* table = index->table;
+    while (table != NULL)
+    {
+        // The old table first - migrated entries are already in the new one
+        index_table_t* old = table->old;
+        entry_t* entry = index_table_find(old, name, len, hash, is_dir);
+        if (entry == NULL)
+        {
+            entry = index_table_find(table, name, len, hash, is_dir);
+        }
+
+        // A table replaced in the meantime may have lost entries to the new one
+        index_table_t* current = index->table;
+        if (entry != NULL || current == table)
+        {
+            return entry;
+        }
+        table = current;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Replace the table of a directory index by a bigger one
+ * 
+ * The new table has room for at least twice the entries, and the current
+ * one is migrated into it by the following modifications.
+ * 
+ * @param ctx    The file system context
+ * @param index  The index to grow
+ * 
+ * @return int  DMFSI_OK on success, DMFSI_ERR_GENERAL if out of memory
+ */
+static int index_grow(dmfsi_context_t ctx, dir_index_t* index)
+{
+    // Finish a pending migration before starting a new one
+    index_migrate(ctx, index, SIZE_MAX);
+
+    size_t capacity = DMRAMFS_INDEX_MIN_CAPACITY;
+    while (capacity < (index->count + 1) * 2)
+    {
+        capacity *= 2;
+    }
+    index_table_t* grown = mount_alloc(ctx, DMRAMFS_INDEX_TABLE_SIZE(capacity));
+    if (grown == NULL)
+    {
+        return DMFSI_ERR_GENERAL;
+    }
+    memset(grown, 0, DMRAMFS_INDEX_TABLE_SIZE(capacity));
+    grown->capacity = capacity;
+    grown->old = index->table;
+
+    index->migrated = 0;
+    index->used = 0;
+    index->table = grown;
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Make sure the next insertion into a directory index cannot fail
+ * 
+ * Completes a pending migration and grows the table if it is full. Removals
+ * never take slots, so the guarantee holds across index_remove calls made
+ * before the insertion.
+ * 
+ * @param ctx    The file system context
+ * @param index  The index to prepare
+ * 
+ * @return int  DMFSI_OK on success, DMFSI_ERR_GENERAL if out of memory
+ */
+static int index_reserve(dmfsi_context_t ctx, dir_index_t* index)
+{
+    index_migrate(ctx, index, SIZE_MAX);
+    index_table_t* table = index->table;
+    size_t capacity = (table != NULL) ? table->capacity : 0;
+    if ((index->used + 1) * 4 > capacity * 3)
+    {
+        return index_grow(ctx, index);
+    }
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Insert an entry into a directory index
+ * 
+ * @param ctx    The file system context
+ * @param index  The index to modify
+ * @param entry  The entry to insert (its hash must be set)
+ * 
+ * @return int  DMFSI_OK on success, DMFSI_ERR_GENERAL if out of memory
+ */
+static int index_insert(dmfsi_context_t ctx, dir_index_t* index, entry_t* entry)
+{
+    index_migrate(ctx, index, DMRAMFS_INDEX_MIGRATE_STEP);
+
+    // Keep the load factor (including removed slots) below 3/4
+    index_table_t* table = index->table;
+    size_t capacity = (table != NULL) ? table->capacity : 0;
+    if ((index->used + 1) * 4 > capacity * 3)
+    {
+        if (index_grow(ctx, index) != DMFSI_OK)
+        {
+            return DMFSI_ERR_GENERAL;
+        }
+        table = index->table;
+    }
+
+    if (index_table_put(table, entry))
+    {
+        index->used++;
+    }
+    index->count++;
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Remove an entry from a directory index
+ * 
+ * @param ctx    The file system context
+ * @param index  The index to modify
+ * @param entry  The entry to remove
+ */
+static void index_remove(dmfsi_context_t ctx, dir_index_t* index, entry_t* entry)
+{
+    index_table_t* table = index->table;
+    index_table_t* tables[2] = { table, (table != NULL) ? table->old : NULL };
+
+    for (int t = 0; t < 2; t++)
+    {
+        if (tables[t] == NULL)
+        {
+            continue;
+        }
+        index_slot_t* slots = tables[t]->slots;
+        size_t mask = tables[t]->capacity - 1;
+        for (size_t i = entry->hash & mask; slots[i].entry != NULL; i = (i + 1) & mask)
+        {
+            if (slots[i].entry == entry)
+            {
+                slots[i].entry = DMRAMFS_INDEX_TOMBSTONE;
+                index->count--;
+                index_migrate(ctx, index, DMRAMFS_INDEX_MIGRATE_STEP);
+                return;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Release the tables of a directory index
+ */
+static void index_free(dmfsi_context_t ctx, dir_index_t* index)
+{
+    index_table_t* table = index->table;
+    if (table != NULL)
+    {
+        if (table->old != NULL)
+        {
+            mount_free(ctx, table->old, DMRAMFS_INDEX_TABLE_SIZE(table->old->capacity));
+        }
+        mount_free(ctx, table, DMRAMFS_INDEX_TABLE_SIZE(table->capacity));
+    }
+    memset(index, 0, sizeof(dir_index_t));
+}
+
+/**
+ * @brief Add a child to a directory
+ * 
+ * The child is indexed by name and appended to the readdir order.
+ * 
+ * @return int  DMFSI_OK on success, DMFSI_ERR_GENERAL if out of memory
+ */
+static int dir_add_child(dmfsi_context_t ctx, dir_t* dir, entry_t* entry)
+{
+    if (index_insert(ctx, &dir->children, entry) != DMFSI_OK)
+    {
+        return DMFSI_ERR_GENERAL;
+    }
+
+    entry->prev_sibling = dir->last_child;
+    entry->next_sibling = NULL;
+    if (dir->last_child != NULL)
+    {
+        dir->last_child->next_sibling = entry;
+    }
+    else
+    {
+        dir->first_child = entry;
+    }
+    dir->last_child = entry;
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Remove a child from a directory
+ * 
+ * Directory handles positioned at the child move on to the next one, so
+ * a listing in progress neither skips nor repeats entries.
+ */
+static void dir_remove_child(dmfsi_context_t ctx, dir_t* dir, entry_t* entry)
+{
+    index_remove(ctx, &dir->children, entry);
+
+    for (dir_handle_t* handle = dir->handles; handle != NULL; handle = handle->next)
+    {
+        if (handle->cursor == entry)
+        {
+            handle->cursor = entry->next_sibling;
+        }
+    }
+
+    if (entry->prev_sibling != NULL)
+    {
+        entry->prev_sibling->next_sibling = entry->next_sibling;
+    }
+    else
+    {
+        dir->first_child = entry->next_sibling;
+    }
+    if (entry->next_sibling != NULL)
+    {
+        entry->next_sibling->prev_sibling = entry->prev_sibling;
+    }
+    else
+    {
+        dir->last_child = entry->prev_sibling;
+    }
+    entry->prev_sibling = NULL;
+    entry->next_sibling = NULL;
+}
+
+/**
+ * @brief Get the slab size class for the given object size
+ * 
+ * @return int  Index of the size class or -1 if the object is too big
+ */
+static int slab_class_index(size_t size)
+{
+    for (int i = 0; i < DMRAMFS_SLAB_CLASS_COUNT; i++)
+    {
+        if (size <= slab_class_sizes[i])
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Allocate an object from the mount slabs
+ * 
+ * @param ctx   The file system context
+ * @param size  The size of the object
+ * 
+ * @return void*  Pointer to the object, or NULL if out of memory or over the quota
+ */
+static void* mount_alloc(dmfsi_context_t ctx, size_t size)
+{
+    return mount_alloc_object(ctx, size, true);
+}
+
+/**
+ * @brief Allocate an object from the mount slabs, charging the memory taken from the heap
+ * 
+ * Objects bigger than the largest size class are allocated from the heap.
+ * 
+ * @param ctx      The file system context
+ * @param size     The size of the object
+ * @param limited  false to exceed the quota if needed (for bookkeeping that must not fail)
+ * 
+ * @return void*  Pointer to the object, or NULL on failure
+ */
+static void* mount_alloc_object(dmfsi_context_t ctx, size_t size, bool limited)
+{
+    int index = slab_class_index(size);
+    if (index < 0)
+    {
+        if (!mount_charge_metadata(ctx, size, limited))
+        {
+            return NULL;
+        }
+        void* object = Dmod_Malloc(size);
+        if (object == NULL)
+        {
+            mount_uncharge_metadata(ctx, size);
+        }
+        return object;
+    }
+
+    slab_t* slab = &ctx->slabs[index];
+    rwlock_lock(&ctx->mount_lock, true);
+    if (slab->free_list == NULL)
+    {
+        size_t object_size = slab_class_sizes[index];
+        size_t count = (DMRAMFS_SLAB_PAGE_SIZE - DMRAMFS_SLAB_HEADER_SIZE) / object_size;
+        slab_page_t* page = NULL;
+        if (mount_charge_metadata(ctx, DMRAMFS_SLAB_PAGE_SIZE, limited))
+        {
+            page = Dmod_Malloc(DMRAMFS_SLAB_PAGE_SIZE);
+            if (page == NULL)
+            {
+                mount_uncharge_metadata(ctx, DMRAMFS_SLAB_PAGE_SIZE);
+            }
+        }
+        if (page == NULL)
+        {
+            rwlock_unlock(&ctx->mount_lock, true);
+            return NULL;
+        }
+        page->next = slab->pages;
+        slab->pages = page;
+
+        char* object = (char*)page + DMRAMFS_SLAB_HEADER_SIZE;
+        for (size_t i = 0; i < count; i++, object += object_size)
+        {
+            *(void**)object = slab->free_list;
+            slab->free_list = object;
+        }
+    }
+
+    void* object = slab->free_list;
+    slab->free_list = *(void**)object;
+    rwlock_unlock(&ctx->mount_lock, true);
+    return object;
+}
+
+/**
+ * @brief Return an object to the mount slabs
+ * 
+ * @param ctx   The file system context
+ * @param ptr   The object to free (may be NULL)
+ * @param size  The size the object was allocated with
+ */
+static void mount_free(dmfsi_context_t ctx, void* ptr, size_t size)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    int index = slab_class_index(size);
+    if (index < 0)
+    {
+        Dmod_Free(ptr);
+        mount_uncharge_metadata(ctx, size);
+        return;
+    }
+
+    slab_t* slab = &ctx->slabs[index];
+    rwlock_lock(&ctx->mount_lock, true);
+    *(void**)ptr = slab->free_list;
+    slab->free_list = ptr;
+    rwlock_unlock(&ctx->mount_lock, true);
+}
+
+/**
+ * @brief Duplicate a name into the mount slabs
+ * 
+ * @param ctx  The file system context
+ * @param str  The string to copy
+ * @param len  The length of the string
+ * 
+ * @return char*  The copy of the string, or NULL on failure
+ */
+static char* mount_strndup(dmfsi_context_t ctx, const char* str, size_t len)
+{
+    char* copy = mount_alloc(ctx, len + 1);
+    if (copy != NULL)
+    {
+        memcpy(copy, str, len);
+        copy[len] = '\0';
+    }
+    return copy;
+}
+
+/**
+ * @brief Free a name allocated by mount_strndup
+ */
+static void mount_free_string(dmfsi_context_t ctx, char* str)
+{
+    if (str != NULL)
+    {
+        mount_free(ctx, str, strlen(str) + 1);
+    }
+}
+
+/**
+ * @brief Set the name of a new file or directory node
+ * 
+ * @param ctx    The file system context
+ * @param entry  The node (not visible to lookups yet)
+ * @param name   The name (not terminated)
+ * @param len    The length of the name
+ * 
+ * @return bool  true on success, false if out of memory
+ */
+static bool entry_init_name(dmfsi_context_t ctx, entry_t* entry, const char* name, size_t len)
+{
+    char* copy = entry->short_name;
+    if (len < DMRAMFS_SHORT_NAME_SIZE)
+    {
+        memcpy(copy, name, len);
+        copy[len] = '\0';
+    }
+    else
+    {
+        copy = mount_strndup(ctx, name, len);
+        if (copy == NULL)
+        {
+            return false;
+        }
+    }
+    entry->name = copy;
+    entry->name_len = (len < DMRAMFS_NAME_LEN_LONG) ? (uint8_t)len : DMRAMFS_NAME_LEN_LONG;
+    entry->hash = name_hash(name, len);
+    return true;
+}
+
+/**
+ * @brief Free the name of a node if it is not stored in the node
+ */
+static void entry_free_name(dmfsi_context_t ctx, entry_t* entry)
+{
+    if (entry->name != entry->short_name)
+    {
+        mount_free_string(ctx, entry->name);
+    }
+}
+
+/**
+ * @brief Compare the name of a node
+ * 
+ * The cached length rejects most names without touching them. It may be
+ * stale while the node is renamed, so the name itself is always checked.
+ * 
+ * @param entry  The node
+ * @param name   The name to compare (not terminated)
+ * @param len    The length of the name
+ * 
+ * @return bool  true if the node has the name
+ */
+static bool entry_name_is(const entry_t* entry, const char* name, size_t len)
+{
+    size_t cached = entry->name_len;
+    if (cached != len && (cached < DMRAMFS_NAME_LEN_LONG || len < DMRAMFS_NAME_LEN_LONG))
+    {
+        return false;
+    }
+    const char* entry_name = entry->name;
+    return strncmp(entry_name, name, len) == 0 && entry_name[len] == '\0';
+}
+
+/**
+ * @brief Release all slab pages of the mount at once
+ * 
+ * @param ctx  The file system context
+ */
+static void mount_release(dmfsi_context_t ctx)
+{
+    for (int i = 0; i < DMRAMFS_SLAB_CLASS_COUNT; i++)
+    {
+        slab_page_t* page = ctx->slabs[i].pages;
+        while (page != NULL)
+        {
+            slab_page_t* next = page->next;
+            Dmod_Free(page);
+            page = next;
+        }
+        ctx->slabs[i].pages = NULL;
+        ctx->slabs[i].free_list = NULL;
+    }
+}
+
+/**
+ * @brief Apply the mount options of the configuration string
+ * 
+ * The options are separated by commas: "size=<bytes>" limits the data and
+ * metadata of the mount (with an optional k, m or g suffix) and
+ * "nr_inodes=<count>" limits the number of files and directories. Values
+ * that do not fit a size_t are rejected.
+ * 
+ * @param ctx     The file system context
+ * @param config  The configuration string (may be NULL)
+ * 
+ * @return bool  true on success, false if an option is not valid
+ */
+static bool mount_configure(dmfsi_context_t ctx, const char* config)
+{
+    const char* option = config;
+    while (option != NULL && *option != '\0')
+    {
+        const char* end = strchr(option, ',');
+        size_t len = (end != NULL) ? (size_t)(end - option) : strlen(option);
+        const char* value = memchr(option, '=', len);
+        size_t* target = NULL;
+        if (value != NULL && (size_t)(value - option) == 4 && strncmp(option, "size", 4) == 0)
+        {
+            target = &ctx->quota_bytes;
+        }
+        else if (value != NULL && (size_t)(value - option) == 9 && strncmp(option, "nr_inodes", 9) == 0)
+        {
+            target = &ctx->quota_inodes;
+        }
+
+        size_t number = 0;
+        const char* p = (value != NULL) ? value + 1 : option + len;
+        const char* option_end = option + len;
+        bool valid = (target != NULL && p < option_end);
+        while (valid && p < option_end && *p >= '0' && *p <= '9')
+        {
+            size_t digit = (size_t)(*p++ - '0');
+            valid = (number <= (SIZE_MAX - digit) / 10);
+            number = number * 10 + digit;
+        }
+        if (valid && p < option_end && target == &ctx->quota_bytes && p + 1 == option_end)
+        {
+            char suffix = *p++;
+            unsigned shift = (suffix == 'k' || suffix == 'K') ? 10 : (suffix == 'm' || suffix == 'M') ? 20
+                           : (suffix == 'g' || suffix == 'G') ? 30 : 0;
+            valid = (shift > 0 && number <= (SIZE_MAX >> shift));
+            number <<= shift;
+        }
+        if (!valid || p != option_end)
+        {
+            DMOD_LOG_ERROR("dmramfs: Invalid mount option '%.*s'\n", (int)len, option);
+            return false;
+        }
+        *target = number;
+        option = (end != NULL) ? end + 1 : option_end;
+    }
+    return true;
+}
+
+/**
+ * @brief Charge bytes against the quota of the mount
+ * 
+ * The quota covers the data and the metadata together.
+ * 
+ * @param ctx      The file system context
+ * @param size     The number of bytes to add
+ * @param limited  false to exceed the quota if needed
+ * 
+ * @return bool  true on success, false if the quota would be exceeded
+ */
+static bool mount_reserve_bytes(dmfsi_context_t ctx, size_t size, bool limited)
+{
+    size_t quota = limited ? ctx->quota_bytes : 0;
+#if DMRAMFS_THREAD_SAFE
+    size_t used = atomic_load(&ctx->used_bytes);
+    do
+    {
+        if (quota > 0 && (size > quota || used > quota - size))
+        {
+            ctx->shortfall = size;
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak(&ctx->used_bytes, &used, used + size));
+#else
+    if (quota > 0 && (size > quota || ctx->used_bytes > quota - size))
+    {
+        ctx->shortfall = size;
+        return false;
+    }
+    ctx->used_bytes += size;
+#endif
+    return true;
+}
+
+/**
+ * @brief Account data bytes to the mount, respecting the quota
+ * 
+ * @param ctx   The file system context
+ * @param size  The number of bytes to add
+ * 
+ * @return bool  true on success, false if the quota would be exceeded
+ */
+static bool mount_charge(dmfsi_context_t ctx, size_t size)
+{
+    if (!mount_reserve_bytes(ctx, size, true))
+    {
+        return false;
+    }
+    ctx->data_bytes += size;
+    return true;
+}
+
+/**
+ * @brief Remove data bytes from the mount totals
+ */
+static void mount_uncharge(dmfsi_context_t ctx, size_t size)
+{
+    ctx->data_bytes -= size;
+    ctx->used_bytes -= size;
+}
+
+/**
+ * @brief Account metadata bytes to the mount
+ * 
+ * @param ctx      The file system context
+ * @param size     The number of bytes to add
+ * @param limited  false to exceed the quota if needed
+ * 
+ * @return bool  true on success, false if the quota would be exceeded
+ */
+static bool mount_charge_metadata(dmfsi_context_t ctx, size_t size, bool limited)
+{
+    if (!mount_reserve_bytes(ctx, size, limited))
+    {
+        return false;
+    }
+    ctx->metadata_bytes += size;
+    return true;
+}
+
+/**
+ * @brief Remove metadata bytes from the mount totals
+ */
+static void mount_uncharge_metadata(dmfsi_context_t ctx, size_t size)
+{
+    ctx->metadata_bytes -= size;
+    ctx->used_bytes -= size;
+}
+
+/**
+ * @brief Account a new file or directory to the mount, respecting the quota
+ * 
+ * @return bool  true on success, false if the quota would be exceeded
+ */
+static bool mount_add_inode(dmfsi_context_t ctx)
+{
+#if DMRAMFS_THREAD_SAFE
+    size_t count = atomic_load(&ctx->inodes);
+    do
+    {
+        if (ctx->quota_inodes > 0 && count >= ctx->quota_inodes)
+        {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak(&ctx->inodes, &count, count + 1));
+#else
+    if (ctx->quota_inodes > 0 && ctx->inodes >= ctx->quota_inodes)
+    {
+        return false;
+    }
+    ctx->inodes++;
+#endif
+    return true;
+}
+
+/**
+ * @brief Remove the coldest evictable files until enough data is released
+ * 
+ * Files or directories locked by other tasks are skipped. Evicted files are
+ * retired, so the caller must not hold any file lock (see mount_make_room).
+ * 
+ * @param ctx    The file system context
+ * @param goal   Number of data bytes to release
+ * @param files  Receives the number of removed files (may be NULL)
+ * 
+ * @return size_t  Number of data bytes released
+ */
+static size_t mount_evict(dmfsi_context_t ctx, size_t goal, size_t* files)
+{
+    size_t released = 0;
+    size_t evicted = 0;
+    while (released < goal)
+    {
+        // Find the coldest file whose directory and file locks are free
+        rwlock_lock(&ctx->lru_lock, true);
+        file_t* file = ctx->lru_head;
+        dir_t* dir = NULL;
+        for (; file != NULL; file = file->lru_next)
+        {
+            dir = file->entry.parent;
+            if (!rwlock_try_lock(&dir->lock))
+            {
+                continue;
+            }
+            if (rwlock_try_lock(&file->lock))
+            {
+                // An unlinked file is about to leave the list
+                if (!file->unlinked)
+                {
+                    break;
+                }
+                rwlock_unlock(&file->lock, true);
+            }
+            rwlock_unlock(&dir->lock, true);
+        }
+        if (file == NULL)
+        {
+            rwlock_unlock(&ctx->lru_lock, true);
+            break;
+        }
+
+        // Files in the list have no handles; mark it, so lookups racing with
+        // the removal do not use it
+        file->unlinked = true;
+        released += file_allocated(file);
+        evicted++;
+        rwlock_unlock(&file->lock, true);
+        rwlock_unlock(&ctx->lru_lock, true);
+        dcache_forget(ctx, &file->entry);
+        dir_remove_child(ctx, dir, &file->entry);
+        rwlock_unlock(&dir->lock, true);
+        free_file(ctx, file);
+    }
+    if (files != NULL)
+    {
+        *files = evicted;
+    }
+    return released;
+}
+
+/**
+ * @brief Evict cold files after an operation failed over the quota
+ * 
+ * Writes through handles call it with the file unlocked and retry while it
+ * returns true, so the shrinker never runs under a file lock.
+ * 
+ * @param ctx     The file system context
+ * @param result  The result of the failed operation
+ * 
+ * @return bool  true if data was released and the operation should be retried
+ */
+static bool mount_make_room(dmfsi_context_t ctx, int result)
+{
+    if (result != DMFSI_ERR_GENERAL || ctx->quota_bytes == 0)
+    {
+        return false;
+    }
+#if DMRAMFS_THREAD_SAFE
+    size_t goal = atomic_exchange(&ctx->shortfall, 0);
+#else
+    size_t goal = ctx->shortfall;
+    ctx->shortfall = 0;
+#endif
+    return goal > 0 && mount_evict(ctx, goal, NULL) > 0;
+}
+
+/**
+ * @brief Append a file without handles to the eviction list (the caller holds the file lock)
+ */
+static void file_lru_insert(file_t* file)
+{
+    dmfsi_context_t ctx = file->mount;
+    rwlock_lock(&ctx->lru_lock, true);
+    file->lru_prev = ctx->lru_tail;
+    file->lru_next = NULL;
+    if (ctx->lru_tail != NULL)
+    {
+        ctx->lru_tail->lru_next = file;
+    }
+    else
+    {
+        ctx->lru_head = file;
+    }
+    ctx->lru_tail = file;
+    rwlock_unlock(&ctx->lru_lock, true);
+}
+
+/**
+ * @brief Remove a file from the eviction list, if it is there (the caller holds the file lock)
+ */
+static void file_lru_remove(file_t* file)
+{
+    dmfsi_context_t ctx = file->mount;
+    rwlock_lock(&ctx->lru_lock, true);
+    if (file->lru_prev != NULL || ctx->lru_head == file)
+    {
+        if (file->lru_prev != NULL)
+        {
+            file->lru_prev->lru_next = file->lru_next;
+        }
+        else
+        {
+            ctx->lru_head = file->lru_next;
+        }
+        if (file->lru_next != NULL)
+        {
+            file->lru_next->lru_prev = file->lru_prev;
+        }
+        else
+        {
+            ctx->lru_tail = file->lru_prev;
+        }
+        file->lru_prev = NULL;
+        file->lru_next = NULL;
+    }
+    rwlock_unlock(&ctx->lru_lock, true);
+}
+
+/**
+ * @brief Get the next component of a path
+ * 
+ * Leading, trailing and repeated slashes are skipped, so "/a//b/" yields
+ * the components "a" and "b". No memory is allocated.
+ * 
+ * @param path       [in/out] The path to parse, advanced past the component
+ * @param component  [out] The component found
+ * 
+ * @return bool  true if a component was found, false at the end of the path
+ */
+static bool path_next(const char** path, path_component_t* component)
+{
+    const char* p = *path;
+    while (*p == '/')
+    {
+        p++;
+    }
+    if (*p == '\0')
+    {
+        *path = p;
+        return false;
+    }
+
+    component->name = p;
+    while (*p != '/' && *p != '\0')
+    {
+        p++;
+    }
+    component->len = (size_t)(p - component->name);
+    *path = p;
+    return true;
+}
+
+/**
+ * @brief Resolve the directory containing the last component of a path
+ * 
+ * @param ctx   The file system context
+ * @param path  The path to resolve
+ * @param last  [out] The last component of the path (empty for the root directory)
+ * 
+ * Must be called inside an epoch (see epoch_enter). The returned directory
+ * is not locked - directories are never freed while the mount exists.
+ * 
+ * @return dir_t*  The parent directory, or NULL if an intermediate directory does not exist
+ */
+static dir_t* resolve_parent(dmfsi_context_t ctx, const char* path, path_component_t* last)
+{
+    dir_t* dir = ctx->root_dir;
+    path_component_t component;
+
+    last->name = path;
+    last->len = 0;
+    if (!path_next(&path, last))
+    {
+        return dir;
+    }
+    while (path_next(&path, &component))
+    {
+        dir = (dir_t*)index_find(&dir->children, last->name, last->len, true);
+        if (dir == NULL)
+        {
+            return NULL;
+        }
+        *last = component;
+    }
+    return dir;
+}
+
+/**
+ * @brief Check if an entry is reachable under the given path
+ * 
+ * The path is compared component by component with the names of the
+ * entry and its ancestors, walking from the end of the path.
+ * 
+ * @param entry  The entry to verify
+ * @param path   The beginning of the path
+ * @param end    The end of the path
+ * 
+ * @return bool  true if the path leads to the entry
+ */
+static bool entry_matches_path(const entry_t* entry, const char* path, const char* end)
+{
+    while (true)
+    {
+        while (end > path && end[-1] == '/')
+        {
+            end--;
+        }
+        if (end == path)
+        {
+            // All components matched - the entry must be the root directory
+            return entry->parent == NULL;
+        }
+
+        const char* start = end;
+        while (start > path && start[-1] != '/')
+        {
+            start--;
+        }
+        if (entry->parent == NULL || !entry_name_is(entry, start, (size_t)(end - start)))
+        {
+            return false;
+        }
+        entry = &entry->parent->entry;
+        end = start;
+    }
+}
+
+/**
+ * @brief Look for a path in the path lookup cache
+ * 
+ * Must be called inside an epoch (see epoch_enter).
+ * 
+ * @param ctx     The file system context
+ * @param path    The path to look for
+ * @param is_dir  true to look for a directory, false to look for a file
+ * @param hash    [out] Hash of the normalized path (for dcache_insert)
+ * 
+ * @return entry_t*  The cached entry, or NULL on a cache miss
+ */
+static entry_t* dcache_lookup(dmfsi_context_t ctx, const char* path, bool is_dir, uint32_t* hash)
+{
+    // Hash the components, so paths differing only in slashes share the slot
+    const char* end = path;
+    path_component_t component;
+    uint32_t h = hash_bytes(DMRAMFS_HASH_SEED, is_dir ? "d" : "f", 1);
+    while (path_next(&end, &component))
+    {
+        h = hash_bytes(h, "/", 1);
+        h = hash_bytes(h, component.name, component.len);
+    }
+    *hash = h;
+
+    dcache_slot_t* slot = &ctx->dcache[h & (DMRAMFS_DCACHE_SIZE - 1)];
+    entry_t* entry = slot->entry;
+    uint32_t slot_hash = slot->hash;
+    if (entry != NULL && slot_hash == h && entry->is_dir == is_dir
+        && entry_matches_path(entry, path, end))
+    {
+        counter_add(&ctx->dcache_hits);
+        return entry;
+    }
+    counter_add(&ctx->dcache_misses);
+    return NULL;
+}
+
+/**
+ * @brief Store a resolved entry in the path lookup cache
+ * 
+ * Unlinked files are not stored - the removal may have already dropped
+ * the file from the cache.
+ * 
+ * @param ctx    The file system context
+ * @param hash   The hash returned by dcache_lookup
+ * @param entry  The resolved entry
+ */
+static void dcache_insert(dmfsi_context_t ctx, uint32_t hash, entry_t* entry)
+{
+    uint16_t index = (uint16_t)(hash & (DMRAMFS_DCACHE_SIZE - 1));
+    dcache_slot_t* slot = &ctx->dcache[index];
+
+    rwlock_lock(&ctx->dcache_lock, true);
+    if (!entry->is_dir && ((file_t*)entry)->unlinked)
+    {
+        rwlock_unlock(&ctx->dcache_lock, true);
+        return;
+    }
+    if (entry->dcache_slot != 0)
+    {
+        ctx->dcache[entry->dcache_slot - 1].entry = NULL;
+    }
+    entry_t* evicted = slot->entry;
+    if (evicted != NULL)
+    {
+        evicted->dcache_slot = 0;
+    }
+    slot->entry = NULL;
+    slot->hash = hash;
+    slot->entry = entry;
+    entry->dcache_slot = index + 1;
+    rwlock_unlock(&ctx->dcache_lock, true);
+}
+
+/**
+ * @brief Drop an entry from the path lookup cache
+ * 
+ * Must be called before the entry is freed, renamed or moved.
+ */
+static void dcache_forget(dmfsi_context_t ctx, entry_t* entry)
+{
+    rwlock_lock(&ctx->dcache_lock, true);
+    if (entry->dcache_slot != 0)
+    {
+        ctx->dcache[entry->dcache_slot - 1].entry = NULL;
+        entry->dcache_slot = 0;
+    }
+    rwlock_unlock(&ctx->dcache_lock, true);
+}
+
+/**
+ * @brief Find a file by its path
+ * 
+ * The path is resolved without locking the directories. The file is locked
+ * before the lock-free section ends; if it was unlinked meanwhile, the
+ * lookup is repeated.
+ * 
+ * @param ctx        The file system context
+ * @param path       The path of the file
+ * @param exclusive  true to return the file write-locked, false to return it read-locked
+ * 
+ * @return file_t*  The locked file, or NULL if not found
+ */
+static file_t* find_file(dmfsi_context_t ctx, const char* path, bool exclusive)
+{
+    while (true)
+    {
+        uint32_t hash;
+        unsigned reader = epoch_enter(ctx);
+        file_t* file = (file_t*)dcache_lookup(ctx, path, false, &hash);
+        if (file == NULL)
+        {
+            path_component_t name;
+            dir_t* dir = resolve_parent(ctx, path, &name);
+            if (dir != NULL && name.len > 0)
+            {
+                file = (file_t*)index_find(&dir->children, name.name, name.len, false);
+            }
+            if (file != NULL)
+            {
+                dcache_insert(ctx, hash, &file->entry);
+            }
+        }
+
+        bool unlinked = false;
+        if (file != NULL)
+        {
+            rwlock_lock(&file->lock, exclusive);
+            unlinked = file->unlinked;
+            if (unlinked)
+            {
+                rwlock_unlock(&file->lock, exclusive);
+            }
+        }
+        epoch_exit(ctx, reader);
+        if (!unlinked)
+        {
+            return file;
+        }
+    }
+}
+
+/**
+ * @brief Find a directory by its path
+ * 
+ * Does not lock anything - directories are never freed while the mount exists.
+ */
+static dir_t* find_dir(dmfsi_context_t ctx, const char* path)
+{
+    uint32_t hash;
+    unsigned reader = epoch_enter(ctx);
+    dir_t* dir = (dir_t*)dcache_lookup(ctx, path, true, &hash);
+    if (dir == NULL)
+    {
+        path_component_t name;
+        dir = resolve_parent(ctx, path, &name);
+        if (dir != NULL && name.len > 0)
+        {
+            dir = (dir_t*)index_find(&dir->children, name.name, name.len, true);
+            if (dir != NULL)
+            {
+                dcache_insert(ctx, hash, &dir->entry);
+            }
+        }
+    }
+    epoch_exit(ctx, reader);
+    return dir;
+}
+
+/**
+ * @brief Create a file at the specified path
+ * 
+ * If another task created the file in the meantime, the existing file is
+ * returned instead.
+ * 
+ * @param ctx   The file system context
+ * @param path  The path to create the file at (the parent directory must exist)
+ * 
+ * @return file_t*  Pointer to the write-locked file, or NULL on failure
+ */
+static file_t* create_file(dmfsi_context_t ctx, const char* path)
+{
+    path_component_t name;
+    unsigned reader = epoch_enter(ctx);
+    dir_t* dir = resolve_parent(ctx, path, &name);
+    epoch_exit(ctx, reader);
+    if (dir == NULL)
+    {
+        DMOD_LOG_ERROR("dmramfs: Directory not found in path for file creation: '%s'\n", path);
+        return NULL;
+    }
+    if (name.len == 0)
+    {
+        return NULL;
+    }
+
+    rwlock_lock(&dir->lock, true);
+    file_t* file = (file_t*)index_find(&dir->children, name.name, name.len, false);
+    if (file != NULL)
+    {
+        rwlock_lock(&file->lock, true);
+        rwlock_unlock(&dir->lock, true);
+        return file;
+    }
+
+    if (!mount_add_inode(ctx))
+    {
+        rwlock_unlock(&dir->lock, true);
+        DMOD_LOG_ERROR("dmramfs: Inode quota exceeded, cannot create '%s'\n", path);
+        return NULL;
+    }
+    file = mount_alloc(ctx, sizeof(file_t));
+    if(file == NULL)
+    {
+        ctx->inodes--;
+        rwlock_unlock(&dir->lock, true);
+        DMOD_LOG_ERROR("dmramfs: Failed to allocate memory for new file '%s'\n", path);
+        return NULL;
+    }
+    memset(file, 0, sizeof(file_t));
+    file->mount = ctx;
+    file->entry.parent = dir;
+    if(!entry_init_name(ctx, &file->entry, name.name, name.len) || dir_add_child(ctx, dir, &file->entry) != DMFSI_OK)
+    {
+        rwlock_unlock(&dir->lock, true);
+        DMOD_LOG_ERROR("dmramfs: Failed to insert new file '%s' into directory\n", path);
+        entry_free_name(ctx, &file->entry);
+        mount_free(ctx, file, sizeof(file_t));
+        ctx->inodes--;
+        return NULL;
+    }
+    rwlock_lock(&file->lock, true);
+    rwlock_unlock(&dir->lock, true);
+    mount_add_file(ctx, file);
+    return file;
+}
+
+/**
+ * @brief Link a file into the mount-wide list of files
+ */
+static void mount_add_file(dmfsi_context_t ctx, file_t* file)
+{
+    rwlock_lock(&ctx->mount_lock, true);
+    file->mount_prev = NULL;
+    file->mount_next = ctx->files;
+    if (ctx->files != NULL)
+    {
+        ctx->files->mount_prev = file;
+    }
+    ctx->files = file;
+    rwlock_unlock(&ctx->mount_lock, true);
+}
+
+/**
+ * @brief Create a file handle for the specified file
+ * 
+ * @param ctx       The file system context
+ * @param file      The file to create a handle for
+ * @param mode      The mode to open the file with
+ * @param attribute The attributes for the file handle
+ * 
+ * @return file_handle_t*  Pointer to the created file handle, or NULL on failure
+ */
+static file_handle_t* create_file_handle(dmfsi_context_t ctx, file_t* file, int mode, int attribute)
+{
+    file_handle_t* handle = mount_alloc(ctx, sizeof(file_handle_t));
+    if (handle == NULL)
+    {
+        DMOD_LOG_ERROR("dmramfs: Failed to allocate memory for file handle\n");
+        return NULL;
+    }
+
+#if DMRAMFS_COMPRESS
+    // Only files without handles are compressed - restore the data for the first one
+    if (file->packed_size > 0)
+    {
+        if (mode & DMFSI_O_TRUNC)
+        {
+            file_free_data(file);
+        }
+        else if (file_unpack(file) != DMFSI_OK)
+        {
+            DMOD_LOG_ERROR("dmramfs: Failed to allocate memory for decompressed file data\n");
+            mount_free(ctx, handle, sizeof(file_handle_t));
+            return NULL;
+        }
+    }
+#endif
+
+    handle->file = file;
+    handle->mode = mode;
+    handle->attribute = attribute;
+    handle->position = 0;
+    handle->mapped = false;
+    handle->reserved = 0;
+    handle->window = NULL;
+
+    // Handle truncate mode - the extents are kept as spare capacity
+    if ((mode & DMFSI_O_TRUNC) && file != NULL)
+    {
+        if (file->pins > 0)
+        {
+            DMOD_LOG_ERROR("dmramfs: Cannot truncate a file with mapped views\n");
+            mount_free(ctx, handle, sizeof(file_handle_t));
+            return NULL;
+        }
+        file->size = 0;
+    }
+
+    // Handle append mode - start at end of file
+    if ((mode & DMFSI_O_APPEND) && file != NULL)
+    {
+        handle->position = file->size;
+    }
+
+    if (attribute & DMRAMFS_ATTR_EVICTABLE)
+    {
+        file->evictable = true;
+    }
+    if (file->handles == NULL)
+    {
+        file_lru_remove(file);
+    }
+    handle->next = file->handles;
+    file->handles = handle;
+
+    return handle;
+}
+
+/**
+ * @brief Allocate and initialize an empty directory
+ * 
+ * @param ctx     The file system context
+ * @param parent  The parent directory (NULL for the root directory)
+ * @param name    The name of the directory (does not need to be NUL terminated)
+ * @param len     The length of the name
+ * 
+ * @return dir_t*  Pointer to the directory, or NULL on failure
+ */
+static dir_t* alloc_dir(dmfsi_context_t ctx, dir_t* parent, const char* name, size_t len)
+{
+    if (!mount_add_inode(ctx))
+    {
+        DMOD_LOG_ERROR("dmramfs: Inode quota exceeded, cannot create directory '%.*s'\n", (int)len, name);
+        return NULL;
+    }
+    dir_t* dir = mount_alloc(ctx, sizeof(dir_t));
+    if (dir == NULL)
+    {
+        ctx->inodes--;
+        DMOD_LOG_ERROR("dmramfs: Failed to allocate memory for directory '%.*s'\n", (int)len, name);
+        return NULL;
+    }
+
+    memset(dir, 0, sizeof(dir_t));
+    dir->entry.is_dir = true;
+    dir->entry.parent = parent;
+
+    if (!entry_init_name(ctx, &dir->entry, name, len))
+    {
+        DMOD_LOG_ERROR("dmramfs: Failed to initialize directory '%.*s'\n", (int)len, name);
+        mount_free(ctx, dir, sizeof(dir_t));
+        ctx->inodes--;
+        return NULL;
+    }
+
+    // Link into the mount-wide list of directories
+    rwlock_lock(&ctx->mount_lock, true);
+    dir->mount_next = ctx->dirs;
+    ctx->dirs = dir;
+    rwlock_unlock(&ctx->mount_lock, true);
+    return dir;
+}
+
+/**
+ * @brief Create the root directory
+ * 
+ * @param ctx  The file system context
+ * 
+ * @return dir_t*  Pointer to the created root directory, or NULL on failure
+ */
+static dir_t* create_root_dir(dmfsi_context_t ctx)
+{
+    return alloc_dir(ctx, NULL, "/", 1);
+}
+
+/**
+ * @brief Create a directory at the specified path
+ * 
+ * Missing intermediate directories are created as well.
+ * 
+ * @param ctx   The file system context
+ * @param path  The path to create the directory at
+ * 
+ * @return dir_t*  Pointer to the created (or already existing) directory, or NULL on failure
+ */
+static dir_t* create_dir(dmfsi_context_t ctx, const char* path)
+{
+    dir_t* dir = ctx->root_dir;
+    path_component_t name;
+
+    while (path_next(&path, &name))
+    {
+        dir_t* parent = dir;
+        unsigned reader = epoch_enter(ctx);
+        dir = (dir_t*)index_find(&parent->children, name.name, name.len, true);
+        epoch_exit(ctx, reader);
+        if (dir != NULL)
+        {
+            continue;
+        }
+
+        // Check again under the write lock - another task may have been faster
+        rwlock_lock(&parent->lock, true);
+        dir = (dir_t*)index_find(&parent->children, name.name, name.len, true);
+        if (dir == NULL)
+        {
+            dir = alloc_dir(ctx, parent, name.name, name.len);
+            if (dir != NULL && dir_add_child(ctx, parent, &dir->entry) != DMFSI_OK)
+            {
+                // The directory stays in the mount-wide list and is released by _deinit
+                DMOD_LOG_ERROR("dmramfs: Failed to insert directory '%s' into parent\n", dir->entry.name);
+                dir = NULL;
+            }
+        }
+        rwlock_unlock(&parent->lock, true);
+        if (dir == NULL)
+        {
+            return NULL;
+        }
+    }
+    return dir;
+}
+
+/**
+ * @brief Make sure a range of the file is backed by extents
+ * 
+ * Only the extents of the range are allocated, the others stay holes.
+ * Existing extents are never moved, and the extents tree only gets the nodes
+ * leading to the new extents. A file without extents keeps up to
+ * DMRAMFS_INLINE_SIZE bytes in its node; the first extent takes over this
+ * data once the file grows beyond it.
+ * 
+ * @param file    The file to extend
+ * @param offset  The offset of the range
+ * @param end     The end of the range (the new size of the file if it grows)
+ * 
+ * @return int  DMFSI_OK on success, DMFSI_ERR_GENERAL if out of memory or over the quota
+ */
+static int file_reserve(file_t* file, size_t offset, size_t end)
+{
+    bool in_node = (file->extent_count == 0 && file->size <= DMRAMFS_INLINE_SIZE);
+    if (in_node && end <= DMRAMFS_INLINE_SIZE)
+    {
+        return DMFSI_OK;
+    }
+    if (end > SIZE_MAX - DMRAMFS_EXTENT_SIZE)
+    {
+        DMOD_LOG_ERROR("dmramfs: File size limit exceeded\n");
+        return DMFSI_ERR_GENERAL;
+    }
+
+    bool migrate = (in_node && file->size > 0);
+    size_t first = offset / DMRAMFS_EXTENT_SIZE;
+    size_t last = (end > offset) ? (end + DMRAMFS_EXTENT_SIZE - 1) / DMRAMFS_EXTENT_SIZE : first;
+    if (migrate && last == 0)
+    {
+        last = 1;
+    }
+    size_t missing = (migrate && first > 0) ? 1 : 0;
+    for (size_t i = first; i < last; i++)
+    {
+        missing += (file_extent(file, i) == NULL) ? 1 : 0;
+    }
+    if (missing == 0)
+    {
+        return DMFSI_OK;
+    }
+
+    // Charge the whole growth first, so nothing is allocated over the quota
+    size_t charge = missing * DMRAMFS_EXTENT_SIZE;
+    if (!mount_charge(file->mount, charge))
+    {
+        DMOD_LOG_ERROR("dmramfs: Mount quota exceeded\n");
+        return DMFSI_ERR_GENERAL;
+    }
+
+    // The inline data moves into the first extent before the tree is used
+    for (size_t i = migrate ? 0 : first; i < last; i = (i + 1 < first) ? first : i + 1)
+    {
+        // The nodes of the tree are metadata charged by the slabs
+        extent_t** slot = file_extent_slot(file, i, true);
+        if (slot != NULL && *slot != NULL)
+        {
+            continue;
+        }
+        extent_t* extent = (slot != NULL) ? extent_alloc() : NULL;
+        if (extent == NULL)
+        {
+            // Already allocated extents stay as spare capacity
+            mount_uncharge(file->mount, missing * DMRAMFS_EXTENT_SIZE);
+            return DMFSI_ERR_GENERAL;
+        }
+        if (migrate && i == 0)
+        {
+            memcpy(extent->data, file->inline_data, file->size);
+        }
+        else if (i * DMRAMFS_EXTENT_SIZE < file->size)
+        {
+            // A hole within the file reads as zeros
+            memset(extent->data, 0, DMRAMFS_EXTENT_SIZE);
+        }
+        if (file->extent_count <= i)
+        {
+            file->extent_count = i + 1;
+        }
+        *slot = extent;
+        missing--;
+    }
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Get the number of bytes of data stored by a file
+ * 
+ * @return size_t  The size of the compressed data of a compressed file, the file size otherwise
+ */
+static size_t file_stored_size(file_t* file)
+{
+#if DMRAMFS_COMPRESS
+    if (file->packed_size > 0)
+    {
+        return file->packed_size;
+    }
+#endif
+    return file->size;
+}
+
+/**
+ * @brief Locate the storage of a file offset
+ * 
+ * @param file    The file
+ * @param offset  The offset
+ * @param length  Receives the number of contiguous bytes stored there, or
+ *                of the hole (may be NULL)
+ * 
+ * @return unsigned char*  The storage of the byte at the offset, NULL if it is in a hole
+ */
+static unsigned char* file_data_at(file_t* file, size_t offset, size_t* length)
+{
+    if (file->extent_count == 0 && file_stored_size(file) <= DMRAMFS_INLINE_SIZE && offset < DMRAMFS_INLINE_SIZE)
+    {
+        if (length != NULL)
+        {
+            *length = DMRAMFS_INLINE_SIZE - offset;
+        }
+        return &file->inline_data[offset];
+    }
+    size_t in_extent = offset % DMRAMFS_EXTENT_SIZE;
+    size_t index = offset / DMRAMFS_EXTENT_SIZE;
+    if (length != NULL)
+    {
+        *length = DMRAMFS_EXTENT_SIZE - in_extent;
+    }
+    extent_t* extent = file_extent(file, index);
+    if (extent == NULL)
+    {
+        return NULL;
+    }
+    return &extent->data[in_extent];
+}
+
+/**
+ * @brief Move the data of a staging file into a file without data
+ * 
+ * @param file    The file receiving the data
+ * @param source  The staging file (must not be used afterwards)
+ */
+static void file_take_data(file_t* file, file_t* source)
+{
+    file->extents = source->extents;
+    file->extent_count = source->extent_count;
+    file->extent_height = source->extent_height;
+    file->size = source->size;
+    memcpy(file->inline_data, source->inline_data, DMRAMFS_INLINE_SIZE);
+}
+
+/**
+ * @brief Allocate an extent referenced by a single file
+ * 
+ * @return extent_t*  The extent (its data is not initialized), or NULL if out of memory
+ */
+static extent_t* extent_alloc(void)
+{
+    extent_t* extent = Dmod_Malloc(sizeof(extent_t));
+    if (extent != NULL)
+    {
+        extent->refs = 1;
+#if DMRAMFS_DEDUP
+        extent->deduplicated = false;
+#endif
+    }
+    return extent;
+}
+
+/**
+ * @brief Drop a reference to an extent, freeing it with the last one
+ */
+static void extent_release(extent_t* extent)
+{
+#if DMRAMFS_DEDUP
+    // The flag cannot change anymore - it is set while the extent is private
+    if (extent->deduplicated)
+    {
+        rwlock_lock(&dedup_lock, true);
+        if (--extent->refs == 1)
+        {
+            // Only the table references the extent
+            extent_t** link = &dedup_table[extent->hash & (DMRAMFS_DEDUP_BUCKETS - 1)];
+            while (*link != extent)
+            {
+                link = &(*link)->dedup_next;
+            }
+            *link = extent->dedup_next;
+            Dmod_Free(extent);
+        }
+        rwlock_unlock(&dedup_lock, true);
+        return;
+    }
+#endif
+#if DMRAMFS_THREAD_SAFE
+    if (atomic_fetch_sub(&extent->refs, 1) == 1)
+#else
+    if (--extent->refs == 0)
+#endif
+    {
+        Dmod_Free(extent);
+    }
+}
+
+/**
+ * @brief Get the number of extent entries covered by an extents tree
+ * 
+ * @param height  The number of levels of the tree
+ * 
+ * @return size_t  DMRAMFS_EXTENT_FANOUT to the power of the height (SIZE_MAX if it does not fit)
+ */
+static size_t extent_span(unsigned height)
+{
+    size_t bits = (size_t)height * DMRAMFS_EXTENT_FANOUT_BITS;
+    return (bits < sizeof(size_t) * 8) ? (size_t)1 << bits : SIZE_MAX;
+}
+
+/**
+ * @brief Release the extents of a range within a subtree, recursively
+ * 
+ * @param ctx       The mount the nodes were allocated from
+ * @param node      The root of the subtree
+ * @param height    The number of levels of the subtree
+ * @param base      The index of the first entry of the subtree
+ * @param first     The first index of the range
+ * @param last      The index past the end of the range
+ * @param released  [in/out] Incremented for every extent released
+ * 
+ * @return bool  true if the node has no entries left (the caller frees it)
+ */
+static bool extent_node_release(dmfsi_context_t ctx, extent_node_t* node, unsigned height, size_t base, size_t first, size_t last, size_t* released)
+{
+    size_t span = extent_span(height - 1);
+    bool empty = true;
+    for (size_t k = 0; k < DMRAMFS_EXTENT_FANOUT; k++)
+    {
+        size_t start = base + k * span;
+        bool inside = (start < last && start + span > first);
+        if (height == 1)
+        {
+            if (node->extents[k] != NULL && inside)
+            {
+                extent_release(node->extents[k]);
+                node->extents[k] = NULL;
+                (*released)++;
+            }
+            empty = empty && (node->extents[k] == NULL);
+            continue;
+        }
+        if (node->children[k] != NULL && inside
+            && extent_node_release(ctx, node->children[k], height - 1, start, first, last, released))
+        {
+            mount_free(ctx, node->children[k], sizeof(extent_node_t));
+            node->children[k] = NULL;
+        }
+        empty = empty && (node->children[k] == NULL);
+    }
+    return empty;
+}
+
+/**
+ * @brief Find the entry of an extent index in the extents tree of a file
+ * 
+ * @param file    The file
+ * @param index   The index of the extent
+ * @param create  true to add the missing nodes leading to the entry
+ * 
+ * @return extent_t**  The entry (NULL for a hole), or NULL if its node does not
+ *                     exist and create is false, or cannot be allocated
+ */
+static extent_t** file_extent_slot(file_t* file, size_t index, bool create)
+{
+    if (file->extents == NULL || index >= extent_span(file->extent_height))
+    {
+        if (!create)
+        {
+            return NULL;
+        }
+        // A new tree is made just high enough; an existing tree becomes the
+        // first subtree of the new levels added on top of it
+        unsigned height = (file->extents != NULL) ? file->extent_height : 0;
+        do
+        {
+            extent_node_t* root = mount_alloc(file->mount, sizeof(extent_node_t));
+            if (root == NULL)
+            {
+                return NULL;
+            }
+            memset(root, 0, sizeof(extent_node_t));
+            if (file->extents == NULL)
+            {
+                do
+                {
+                    height++;
+                } while (index >= extent_span(height));
+            }
+            else
+            {
+                root->children[0] = file->extents;
+                height++;
+            }
+            file->extents = root;
+            file->extent_height = height;
+        } while (index >= extent_span(height));
+    }
+
+    extent_node_t* node = file->extents;
+    for (unsigned level = file->extent_height; level > 1; level--)
+    {
+        extent_node_t** child = &node->children[(index >> ((level - 1) * DMRAMFS_EXTENT_FANOUT_BITS)) % DMRAMFS_EXTENT_FANOUT];
+        if (*child == NULL)
+        {
+            if (!create)
+            {
+                return NULL;
+            }
+            *child = mount_alloc(file->mount, sizeof(extent_node_t));
+            if (*child == NULL)
+            {
+                return NULL;
+            }
+            memset(*child, 0, sizeof(extent_node_t));
+        }
+        node = *child;
+    }
+    return &node->extents[index % DMRAMFS_EXTENT_FANOUT];
+}
+
+/**
+ * @brief Get the extent of an index of a file
+ * 
+ * @return extent_t*  The extent, NULL for a hole
+ */
+static extent_t* file_extent(file_t* file, size_t index)
+{
+    extent_t** slot = file_extent_slot(file, index, false);
+    return (slot != NULL) ? *slot : NULL;
+}
+
+/**
+ * @brief Find the next extent of a file, skipping the holes
+ * 
+ * Missing subtrees are skipped as a whole, so walking a sparse file costs
+ * time for its extents only.
+ * 
+ * @param file   The file
+ * @param index  [in/out] The index to start at; receives the index of the extent found
+ * @param end    The index to stop at
+ * 
+ * @return extent_t**  The entry of the extent, or NULL if there is none before the end
+ */
+static extent_t** file_next_extent(file_t* file, size_t* index, size_t end)
+{
+    size_t span = (file->extents != NULL) ? extent_span(file->extent_height) : 0;
+    if (end > span)
+    {
+        end = span;
+    }
+    size_t i = *index;
+    while (i < end)
+    {
+        extent_node_t* node = file->extents;
+        size_t node_span = span;
+        for (unsigned level = file->extent_height; level > 1 && node != NULL; level--)
+        {
+            node_span /= DMRAMFS_EXTENT_FANOUT;
+            node = node->children[(i / node_span) % DMRAMFS_EXTENT_FANOUT];
+        }
+        if (node == NULL)
+        {
+            i = (i / node_span + 1) * node_span;
+            continue;
+        }
+        for (size_t k = i % DMRAMFS_EXTENT_FANOUT; k < DMRAMFS_EXTENT_FANOUT && i < end; k++, i++)
+        {
+            if (node->extents[k] != NULL)
+            {
+                *index = i;
+                return &node->extents[k];
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Release the extents of a range of a file
+ * 
+ * The nodes of the extents tree left without entries are freed. The caller
+ * uncharges the released data and drops the windows of the handles.
+ * 
+ * @param file   The file
+ * @param first  The first extent index of the range
+ * @param last   The extent index past the end of the range
+ * 
+ * @return size_t  The number of extents released
+ */
+static size_t file_release_extents(file_t* file, size_t first, size_t last)
+{
+    size_t released = 0;
+    if (file->extents != NULL
+        && extent_node_release(file->mount, file->extents, file->extent_height, 0, first, last, &released))
+    {
+        mount_free(file->mount, file->extents, sizeof(extent_node_t));
+        file->extents = NULL;
+        file->extent_height = 0;
+    }
+    return released;
+}
+
+/**
+ * @brief Give the file private copies of the shared extents of a range
+ * 
+ * Must be called before the range is modified. The references of other
+ * files (and their handles) are not affected.
+ * 
+ * @param file    The file to modify
+ * @param offset  The offset of the range
+ * @param size    The size of the range in bytes
+ * 
+ * @return int  DMFSI_OK on success, DMFSI_ERR_GENERAL if out of memory
+ */
+static int file_unshare(file_t* file, size_t offset, size_t size)
+{
+    if (size == 0)
+    {
+        return DMFSI_OK;
+    }
+    size_t last = (offset + size - 1) / DMRAMFS_EXTENT_SIZE;
+    extent_t** slot;
+    for (size_t i = offset / DMRAMFS_EXTENT_SIZE; (slot = file_next_extent(file, &i, last + 1)) != NULL; i++)
+    {
+        extent_t* extent = *slot;
+        if (extent->refs > 1)
+        {
+            extent_t* copy = extent_alloc();
+            if (copy == NULL)
+            {
+                return DMFSI_ERR_GENERAL;
+            }
+            memcpy(copy->data, extent->data, DMRAMFS_EXTENT_SIZE);
+            *slot = copy;
+            file_drop_windows(file);
+            extent_release(extent);
+        }
+    }
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Make a file reference the data of another file
+ * 
+ * The extents are shared, not copied - both files copy an extent on their
+ * first write to it. An extent exposed through a pending reservation of the
+ * source (see file_reserve_view) may still be written in place, so it is
+ * copied instead. The target must not have any data.
+ * 
+ * @param file    The file receiving the data
+ * @param source  The file to take the data from (locked by the caller)
+ * 
+ * @return int  DMFSI_OK on success, DMFSI_ERR_GENERAL if out of memory
+ */
+static int file_share_data(file_t* file, file_t* source)
+{
+    // The compressed data is shared as it is
+    size_t stored = file_stored_size(source);
+#if DMRAMFS_COMPRESS
+    file->packed_size = source->packed_size;
+#endif
+    if (source->extent_count == 0)
+    {
+        if (stored <= DMRAMFS_INLINE_SIZE)
+        {
+            memcpy(file->inline_data, source->inline_data, stored);
+        }
+        file->size = source->size;
+        return DMFSI_OK;
+    }
+    size_t count = (stored + DMRAMFS_EXTENT_SIZE - 1) / DMRAMFS_EXTENT_SIZE;
+    if (count > source->extent_count)
+    {
+        count = source->extent_count;
+    }
+    size_t allocated = 0;
+    for (size_t i = 0; file_next_extent(source, &i, count) != NULL; i++)
+    {
+        allocated++;
+    }
+    if (!mount_charge(file->mount, allocated * DMRAMFS_EXTENT_SIZE))
+    {
+        DMOD_LOG_ERROR("dmramfs: Mount quota exceeded\n");
+        return DMFSI_ERR_GENERAL;
+    }
+
+    // Only the nodes leading to extents are copied, so holes stay free
+    extent_t** source_slot;
+    for (size_t i = 0; (source_slot = file_next_extent(source, &i, count)) != NULL; i++)
+    {
+        extent_t* extent = *source_slot;
+        extent_t** slot = file_extent_slot(file, i, true);
+        if (slot == NULL)
+        {
+            mount_uncharge(file->mount, allocated * DMRAMFS_EXTENT_SIZE);
+            DMOD_LOG_ERROR("dmramfs: Mount quota exceeded\n");
+            return DMFSI_ERR_GENERAL;
+        }
+        bool reserved = false;
+        for (file_handle_t* handle = source->handles; handle != NULL; handle = handle->next)
+        {
+            reserved |= (handle->reserved > 0 && handle->position / DMRAMFS_EXTENT_SIZE == i);
+        }
+        if (reserved)
+        {
+            extent_t* copy = extent_alloc();
+            if (copy == NULL)
+            {
+                mount_uncharge(file->mount, allocated * DMRAMFS_EXTENT_SIZE);
+                return DMFSI_ERR_GENERAL;
+            }
+            memcpy(copy->data, extent->data, DMRAMFS_EXTENT_SIZE);
+            extent = copy;
+        }
+        else
+        {
+#if DMRAMFS_THREAD_SAFE
+            atomic_fetch_add(&extent->refs, 1);
+#else
+            extent->refs++;
+#endif
+        }
+        *slot = extent;
+        file->extent_count = i + 1;
+        allocated--;
+    }
+    file->extent_count = count;
+    file->size = source->size;
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Copy data out of the file storage
+ * 
+ * @param file    The file to read from
+ * @param offset  The offset to start reading at
+ * @param buffer  The destination buffer
+ * @param size    The maximum number of bytes to read
+ * 
+ * @return size_t  The number of bytes read (limited by the file size, holes read as zeros)
+ */
+static size_t file_read_at(file_t* file, size_t offset, void* buffer, size_t size)
+{
+    if (offset >= file->size)
+    {
+        return 0;
+    }
+    if (size > file->size - offset)
+    {
+        size = file->size - offset;
+    }
+
+    char* dst = (char*)buffer;
+    size_t remaining = size;
+    while (remaining > 0)
+    {
+        size_t chunk;
+        const unsigned char* data = file_data_at(file, offset, &chunk);
+        if (chunk > remaining)
+        {
+            chunk = remaining;
+        }
+        if (data != NULL)
+        {
+            memcpy(dst, data, chunk);
+        }
+        else
+        {
+            memset(dst, 0, chunk);  // Hole
+        }
+        dst += chunk;
+        offset += chunk;
+        remaining -= chunk;
+    }
+    return size;
+}
+
+/**
+ * @brief Copy data into the file storage
+ * 
+ * The range must already be backed by extents or the inline data (see
+ * file_reserve) that are not shared (see file_unshare).
+ * 
+ * @param file    The file to write to
+ * @param offset  The offset to start writing at
+ * @param buffer  The source buffer
+ * @param size    The number of bytes to write
+ */
+static void file_write_at(file_t* file, size_t offset, const void* buffer, size_t size)
+{
+    const char* src = (const char*)buffer;
+    while (size > 0)
+    {
+        size_t chunk;
+        unsigned char* data = file_data_at(file, offset, &chunk);
+        if (chunk > size)
+        {
+            chunk = size;
+        }
+        memcpy(data, src, chunk);
+        src += chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+}
+
+/**
+ * @brief Write data at the given offset, growing the file if needed
+ * 
+ * A gap between the current end of file and the offset becomes a hole,
+ * only the extents of the written range are allocated.
+ * 
+ * @param file    The file to write to
+ * @param offset  The offset to start writing at
+ * @param buffer  The source buffer
+ * @param size    The number of bytes to write
+ * 
+ * @return int  DMFSI_OK on success, DMFSI_ERR_INVALID if the data is mapped or
+ *              the range ends beyond SIZE_MAX, DMFSI_ERR_GENERAL if out of memory
+ */
+static int file_write(file_t* file, size_t offset, const void* buffer, size_t size)
+{
+    if (file->pins > 0)
+    {
+        DMOD_LOG_ERROR("dmramfs: Cannot modify a file with mapped views\n");
+        return DMFSI_ERR_INVALID;
+    }
+    if (size > SIZE_MAX - offset)
+    {
+        return DMFSI_ERR_INVALID;
+    }
+
+    // Allocate extents for the written range if needed and copy the shared
+    // extents of the range (including the allocated part of a gap)
+    size_t end_position = offset + size;
+    size_t start = (offset < file->size) ? offset : file->size;
+    if (file_reserve(file, offset, end_position) != DMFSI_OK
+        || file_unshare(file, start, end_position - start) != DMFSI_OK)
+    {
+        DMOD_LOG_ERROR("dmramfs: Failed to allocate memory for file data\n");
+        return DMFSI_ERR_GENERAL;
+    }
+    file_extend(file, offset, end_position);
+
+    file_write_at(file, offset, buffer, size);
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Move the end of file after data was written into reserved extents
+ * 
+ * The allocated part of a gap between the current end of file and the
+ * offset is zero-filled, the rest is a hole.
+ * 
+ * @param file    The file to extend
+ * @param offset  The offset the data was written at
+ * @param end     The end of the written data
+ */
+static void file_extend(file_t* file, size_t offset, size_t end)
+{
+    if (end <= file->size)
+    {
+        return;
+    }
+    if (offset > file->size)
+    {
+        file_zero_range(file, file->size, offset - file->size);
+    }
+    file->size = end;
+}
+
+/**
+ * @brief Allocate storage for the file up to the given size without changing its size
+ * 
+ * Holes within the range are filled with zeroed extents.
+ * 
+ * @param file  The file to allocate storage for
+ * @param size  The number of bytes that must be backed by storage
+ * 
+ * @return int  DMFSI_OK on success, DMFSI_ERR_INVALID if the data is mapped,
+ *              DMFSI_ERR_GENERAL if out of memory or over the quota
+ */
+static int file_preallocate(file_t* file, size_t size)
+{
+    // Moving inline data into extents would invalidate the views
+    if (file->pins > 0)
+    {
+        DMOD_LOG_ERROR("dmramfs: Cannot modify a file with mapped views\n");
+        return DMFSI_ERR_INVALID;
+    }
+    if (file_reserve(file, 0, size) != DMFSI_OK)
+    {
+        DMOD_LOG_ERROR("dmramfs: Failed to preallocate file storage\n");
+        return DMFSI_ERR_GENERAL;
+    }
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Set the size of the file
+ * 
+ * Truncated extents are kept as spare capacity (released when the last
+ * handle is closed), so shrinking never frees or copies data. Extending
+ * zeroes the spare capacity in the new range and leaves the rest a hole.
+ * 
+ * @param file  The file to resize
+ * @param size  The new size in bytes
+ * 
+ * @return int  DMFSI_OK on success, DMFSI_ERR_INVALID if the data is mapped,
+ *              DMFSI_ERR_GENERAL if out of memory or over the quota
+ */
+static int file_truncate(file_t* file, size_t size)
+{
+    if (file->pins > 0)
+    {
+        DMOD_LOG_ERROR("dmramfs: Cannot modify a file with mapped views\n");
+        return DMFSI_ERR_INVALID;
+    }
+    if (size <= file->size)
+    {
+        if (file->extent_count == 0 && file->size > DMRAMFS_INLINE_SIZE)
+        {
+            // The file was a single hole, its inline data is stale
+            memset(file->inline_data, 0, DMRAMFS_INLINE_SIZE);
+        }
+        file->size = size;
+        return DMFSI_OK;
+    }
+    // Only moves inline data into an extent if the file outgrows the node
+    if (file_reserve(file, size, size) != DMFSI_OK || file_unshare(file, file->size, size - file->size) != DMFSI_OK)
+    {
+        DMOD_LOG_ERROR("dmramfs: Failed to allocate memory for file data\n");
+        return DMFSI_ERR_GENERAL;
+    }
+    file_zero_range(file, file->size, size - file->size);
+    file->size = size;
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Turn a range of the file into a hole
+ * 
+ * The extents entirely within the range are released, the rest of the range
+ * is filled with zeros. The size of the file is not changed.
+ * 
+ * @param file    The file to modify
+ * @param offset  The offset of the range
+ * @param length  The size of the range in bytes (limited by the file size)
+ * 
+ * @return int  DMFSI_OK on success, DMFSI_ERR_INVALID if the data is mapped or
+ *              reserved, DMFSI_ERR_GENERAL if out of memory
+ */
+static int file_punch_hole(file_t* file, size_t offset, size_t length)
+{
+    bool busy = (file->pins > 0);
+    for (file_handle_t* handle = file->handles; handle != NULL; handle = handle->next)
+    {
+        busy |= (handle->reserved > 0);
+    }
+    if (busy)
+    {
+        DMOD_LOG_ERROR("dmramfs: Cannot punch a hole into a file while it is mapped or reserved\n");
+        return DMFSI_ERR_INVALID;
+    }
+    if (offset >= file->size || length == 0)
+    {
+        return DMFSI_OK;
+    }
+    size_t end = (length < file->size - offset) ? offset + length : file->size;
+
+    // The extents partially within the range keep their data outside of it;
+    // the last extent of the file only holds data up to the end of file
+    size_t first = (offset + DMRAMFS_EXTENT_SIZE - 1) / DMRAMFS_EXTENT_SIZE;
+    size_t last = (end == file->size) ? (end + DMRAMFS_EXTENT_SIZE - 1) / DMRAMFS_EXTENT_SIZE
+                                      : end / DMRAMFS_EXTENT_SIZE;
+    if (file->extent_count == 0 || first >= last)
+    {
+        first = last = 0;
+    }
+    size_t head_end = (first < last && first * DMRAMFS_EXTENT_SIZE < end) ? first * DMRAMFS_EXTENT_SIZE : end;
+    size_t tail = (first < last && last * DMRAMFS_EXTENT_SIZE < end) ? last * DMRAMFS_EXTENT_SIZE : end;
+    if (file_unshare(file, offset, head_end - offset) != DMFSI_OK || file_unshare(file, tail, end - tail) != DMFSI_OK)
+    {
+        DMOD_LOG_ERROR("dmramfs: Failed to allocate memory for file data\n");
+        return DMFSI_ERR_GENERAL;
+    }
+    file_zero_range(file, offset, head_end - offset);
+    file_zero_range(file, tail, end - tail);
+
+    if (first < last)
+    {
+        file_drop_windows(file);
+    }
+    mount_uncharge(file->mount, file_release_extents(file, first, last) * DMRAMFS_EXTENT_SIZE);
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Read data at the given offset into several buffers
+ * 
+ * @param file    The file to read from
+ * @param offset  The offset to start reading at
+ * @param vector  [in/out] The segments to fill; receives the number of bytes read
+ * 
+ * @return int  DMFSI_OK on success, DMFSI_ERR_INVALID if a segment has no buffer
+ */
+static int file_readv(file_t* file, size_t offset, dmramfs_vector_t* vector)
+{
+    vector->transferred = 0;
+    for (size_t i = 0; i < vector->count; i++)
+    {
+        const dmramfs_iovec_t* segment = &vector->iov[i];
+        if (segment->base == NULL && segment->length > 0)
+        {
+            return DMFSI_ERR_INVALID;
+        }
+        size_t read = file_read_at(file, offset, segment->base, segment->length);
+        offset += read;
+        vector->transferred += read;
+        if (read < segment->length)
+        {
+            break;  // End of file
+        }
+    }
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Write several buffers at the given offset, growing the file once
+ * 
+ * @param file    The file to write to
+ * @param offset  The offset to start writing at
+ * @param vector  [in/out] The segments to write; receives the number of bytes written
+ * 
+ * @return int  DMFSI_OK on success, DMFSI_ERR_INVALID if the data is mapped or
+ *              a segment has no buffer, DMFSI_ERR_GENERAL if out of memory
+ */
+static int file_writev(file_t* file, size_t offset, dmramfs_vector_t* vector)
+{
+    vector->transferred = 0;
+    if (file->pins > 0)
+    {
+        DMOD_LOG_ERROR("dmramfs: Cannot modify a file with mapped views\n");
+        return DMFSI_ERR_INVALID;
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < vector->count; i++)
+    {
+        const dmramfs_iovec_t* segment = &vector->iov[i];
+        if ((segment->base == NULL && segment->length > 0) || segment->length > SIZE_MAX - offset - total)
+        {
+            return DMFSI_ERR_INVALID;
+        }
+        total += segment->length;
+    }
+
+    size_t end_position = offset + total;
+    size_t start = (offset < file->size) ? offset : file->size;
+    if (file_reserve(file, offset, end_position) != DMFSI_OK
+        || file_unshare(file, start, end_position - start) != DMFSI_OK)
+    {
+        DMOD_LOG_ERROR("dmramfs: Failed to allocate memory for file data\n");
+        return DMFSI_ERR_GENERAL;
+    }
+    file_extend(file, offset, end_position);
+
+    for (size_t i = 0; i < vector->count; i++)
+    {
+        file_write_at(file, offset, vector->iov[i].base, vector->iov[i].length);
+        offset += vector->iov[i].length;
+    }
+    vector->transferred = total;
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Map a view of the file data without copying it
+ * 
+ * The view covers the contiguous bytes of a single extent (or of the inline
+ * data) starting at the requested offset. The first view pins the file for the handle: until the
+ * handle is unmapped or closed, the file data cannot be modified, so the
+ * views stay valid. A file with reserved regions cannot be mapped, as they
+ * are written in place.
+ * 
+ * @param handle  The file handle
+ * @param map     [in/out] The offset to map; receives the view
+ * 
+ * @return int  DMFSI_OK on success, DMFSI_ERR_INVALID if the offset is beyond
+ *              the end of file or a handle of the file has a reserved region
+ */
+static int file_map(file_handle_t* handle, dmramfs_map_t* map)
+{
+    file_t* file = handle->file;
+    if (map->offset > file->size)
+    {
+        return DMFSI_ERR_INVALID;
+    }
+    for (file_handle_t* other = file->handles; other != NULL; other = other->next)
+    {
+        if (other->reserved > 0)
+        {
+            DMOD_LOG_ERROR("dmramfs: Cannot map a file with reserved regions\n");
+            return DMFSI_ERR_INVALID;
+        }
+    }
+
+    if (!handle->mapped)
+    {
+        handle->mapped = true;
+        file->pins++;
+    }
+
+    size_t remaining = file->size - map->offset;
+    if (remaining == 0)
+    {
+        map->data = NULL;
+        map->length = 0;
+        return DMFSI_OK;
+    }
+
+    size_t length;
+    map->data = (const char*)file_data_at(file, map->offset, &length);
+    if (map->data == NULL)
+    {
+        map->data = (const char*)&hole_data[map->offset % DMRAMFS_EXTENT_SIZE];
+    }
+    map->length = (length < remaining) ? length : remaining;
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Reserve a writable region of the file storage at the handle position
+ * 
+ * The region covers the contiguous bytes of a single extent, so it may be
+ * shorter than requested. It points into the live storage: the bytes within
+ * the current size replace the file data as soon as they are written, the
+ * bytes beyond the end of file are appended when committed with file_commit.
+ * 
+ * @param handle   The file handle
+ * @param reserve  [in/out] The requested size; receives the writable region
+ * 
+ * @return int  DMFSI_OK on success, DMFSI_ERR_INVALID if the data is mapped,
+ *              DMFSI_ERR_GENERAL if out of memory
+ */
+static int file_reserve_view(file_handle_t* handle, dmramfs_reserve_t* reserve)
+{
+    file_t* file = handle->file;
+    size_t offset = handle->position;
+
+    handle->reserved = 0;
+    reserve->data = NULL;
+    reserve->length = 0;
+    if (file->pins > 0)
+    {
+        DMOD_LOG_ERROR("dmramfs: Cannot modify a file with mapped views\n");
+        return DMFSI_ERR_INVALID;
+    }
+    if (reserve->size == 0)
+    {
+        return DMFSI_OK;
+    }
+
+    size_t in_extent = offset % DMRAMFS_EXTENT_SIZE;
+    size_t length = DMRAMFS_EXTENT_SIZE - in_extent;
+    if (length > reserve->size)
+    {
+        length = reserve->size;
+    }
+    // The region must not move before it is committed, so it is never inline
+    size_t start = (offset < file->size) ? offset : file->size;
+    size_t backed = (offset + length > DMRAMFS_INLINE_SIZE) ? offset + length : DMRAMFS_INLINE_SIZE + 1;
+    if (file_reserve(file, offset, backed) != DMFSI_OK
+        || file_unshare(file, start, offset + length - start) != DMFSI_OK)
+    {
+        DMOD_LOG_ERROR("dmramfs: Failed to allocate memory for file data\n");
+        return DMFSI_ERR_GENERAL;
+    }
+
+    handle->reserved = length;
+    reserve->data = (char*)file_extent(file, offset / DMRAMFS_EXTENT_SIZE)->data + in_extent;
+    reserve->length = length;
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Commit the data written into the reserved region
+ * 
+ * @param handle  The file handle
+ * @param size    The number of bytes written (at most the reserved length)
+ * 
+ * @return int  DMFSI_OK on success, DMFSI_ERR_INVALID if more than reserved was
+ *              committed or the data is mapped
+ */
+static int file_commit(file_handle_t* handle, size_t size)
+{
+    if (size > handle->reserved)
+    {
+        return DMFSI_ERR_INVALID;
+    }
+    if (handle->file->pins > 0)
+    {
+        // Cannot happen while file_map refuses reserved files; the views must not change
+        DMOD_LOG_ERROR("dmramfs: Cannot modify a file with mapped views\n");
+        handle->reserved = 0;
+        return DMFSI_ERR_INVALID;
+    }
+
+    file_extend(handle->file, handle->position, handle->position + size);
+    handle->position += size;
+    handle->reserved = 0;
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Cache the extent of the handle position for character I/O
+ * 
+ * The window is dropped if the position is not backed by an extent.
+ */
+static void handle_set_window(file_handle_t* handle)
+{
+    file_t* file = handle->file;
+    size_t index = handle->position / DMRAMFS_EXTENT_SIZE;
+    handle->window = file_extent(file, index);
+    handle->window_start = index * DMRAMFS_EXTENT_SIZE;
+}
+
+/**
+ * @brief Drop the cached extents of all handles of the file
+ * 
+ * Must be called whenever extents of the file are freed or replaced.
+ */
+static void file_drop_windows(file_t* file)
+{
+    for (file_handle_t* handle = file->handles; handle != NULL; handle = handle->next)
+    {
+        handle->window = NULL;
+    }
+}
+
+/**
+ * @brief Release the views mapped by the handle
+ */
+static void file_unmap(file_handle_t* handle)
+{
+    if (handle->mapped)
+    {
+        handle->mapped = false;
+        handle->file->pins--;
+    }
+}
+
+/**
+ * @brief Fill a range of the file storage with zeros
+ * 
+ * Holes already read as zeros, so they are skipped.
+ * 
+ * @param file    The file to modify
+ * @param offset  The offset of the range
+ * @param size    The size of the range in bytes
+ */
+static void file_zero_range(file_t* file, size_t offset, size_t size)
+{
+    while (size > 0)
+    {
+        size_t chunk;
+        unsigned char* data = file_data_at(file, offset, &chunk);
+        if (data == NULL && offset / DMRAMFS_EXTENT_SIZE >= file->extent_count)
+        {
+            break;  // The rest of the range is a hole
+        }
+        if (chunk > size)
+        {
+            chunk = size;
+        }
+        if (data != NULL)
+        {
+            memset(data, 0, chunk);
+        }
+        offset += chunk;
+        size -= chunk;
+    }
+}
+
+/**
+ * @brief Release spare extents of a file
+ * 
+ * The data of a file that fits the inline data is moved there. Holes at the
+ * end of the extents tree are dropped from it.
+ * 
+ * @param file   The file to shrink
+ * @param spare  The spare capacity (in bytes) the file is allowed to keep
+ */
+static void file_shrink(file_t* file, size_t spare)
+{
+    size_t used = (file->size + DMRAMFS_EXTENT_SIZE - 1) / DMRAMFS_EXTENT_SIZE;
+    size_t keep = used + spare / DMRAMFS_EXTENT_SIZE;
+    if (file->size <= DMRAMFS_INLINE_SIZE && file->extent_count > 0)
+    {
+        // Move a tiny file back into its node
+        extent_t* extent = file_extent(file, 0);
+        if (extent != NULL)
+        {
+            memcpy(file->inline_data, extent->data, file->size);
+        }
+        else
+        {
+            memset(file->inline_data, 0, file->size);
+        }
+        keep = 0;
+    }
+    if (file->extent_count > keep)
+    {
+        file_drop_windows(file);
+        mount_uncharge(file->mount, file_release_extents(file, keep, SIZE_MAX) * DMRAMFS_EXTENT_SIZE);
+        file->extent_count = keep;
+    }
+    if (file->extent_count > 0 && file_extent(file, file->extent_count - 1) == NULL)
+    {
+        size_t count = 0;
+        for (size_t i = 0; file_next_extent(file, &i, file->extent_count) != NULL; i++)
+        {
+            count = i + 1;
+        }
+        file->extent_count = count;
+    }
+}
+
+/**
+ * @brief Release all data extents of a file and reset its size
+ * 
+ * @param file  The file to clear
+ */
+static void file_free_data(file_t* file)
+{
+    file_drop_windows(file);
+    mount_uncharge(file->mount, file_release_extents(file, 0, SIZE_MAX) * DMRAMFS_EXTENT_SIZE);
+    file->extent_count = 0;
+    file->size = 0;
+#if DMRAMFS_COMPRESS
+    file->packed_size = 0;
+#endif
+}
+
+/**
+ * @brief Get the number of bytes of the extents of a file
+ * 
+ * @param file  The file (locked by the caller)
+ * 
+ * @return size_t  The allocated size; holes and inline data take none
+ */
+static size_t file_allocated(file_t* file)
+{
+    size_t allocated = 0;
+    for (size_t i = 0; file_next_extent(file, &i, SIZE_MAX) != NULL; i++)
+    {
+        allocated += DMRAMFS_EXTENT_SIZE;
+    }
+    return allocated;
+}
+
+/**
+ * @brief Free a file and all its resources
+ * 
+ * @param ctx   The file system context
+ * @param file  The file to free
+ */
+static void free_file(dmfsi_context_t ctx, file_t* file)
+{
+    if (file == NULL)
+    {
+        return;
+    }
+
+    dcache_forget(ctx, &file->entry);
+    file_lru_remove(file);
+    file_free_data(file);
+
+    // Free all handles
+    while (file->handles != NULL)
+    {
+        file_handle_t* handle = file->handles;
+        file->handles = handle->next;
+        mount_free(ctx, handle, sizeof(file_handle_t));
+    }
+
+    // Unlink from the mount-wide list of files
+    rwlock_lock(&ctx->mount_lock, true);
+    if (file->mount_prev != NULL)
+    {
+        file->mount_prev->mount_next = file->mount_next;
+    }
+    else
+    {
+        ctx->files = file->mount_next;
+    }
+    if (file->mount_next != NULL)
+    {
+        file->mount_next->mount_prev = file->mount_prev;
+    }
+    rwlock_unlock(&ctx->mount_lock, true);
+
+    ctx->inodes--;
+
+    // Lock-free lookups may still hold the file or read its name
+    char* name = file->entry.name;
+    if (name != file->entry.short_name)
     {
-        return 1;
+        epoch_retire(ctx, name, strlen(name) + 1);
     }
-    
-    // Remove leading slash if present
-    const char* search_path = path;
-    if (search_path[0] == '/')
+    epoch_retire(ctx, file, sizeof(file_t));
+}
+
+/**
+ * @brief Create a file sharing the data of another one
+ * 
+ * The data is shared copy-on-write. An existing target is overwritten,
+ * unless it has mapped views or reserved regions pointing into its data.
+ * 
+ * @param ctx     The file system context
+ * @param source  The file to clone (not locked)
+ * @param path    The path of the clone
+ * 
+ * @return int  DMFSI_OK on success, DMFSI_ERR_INVALID if the target is in use,
+ *              DMFSI_ERR_NOT_FOUND if the parent directory does not exist,
+ *              DMFSI_ERR_GENERAL if out of memory
+ */
+static int file_clone(dmfsi_context_t ctx, file_t* source, const char* path)
+{
+    // Take the references first - two files are never locked at once
+    file_t data;
+    memset(&data, 0, sizeof(file_t));
+    data.mount = ctx;
+    rwlock_lock(&source->lock, false);
+    int result = file_share_data(&data, source);
+    rwlock_unlock(&source->lock, false);
+    if (result != DMFSI_OK)
     {
-        search_path++;
+        DMOD_LOG_ERROR("dmramfs: Failed to allocate memory for clone '%s'\n", path);
+        file_free_data(&data);
+        return result;
     }
-    
-    // Remove trailing slash if present
-    size_t len = strlen(search_path);
-    char* clean_path = dmfsi_strndup(search_path, len);
-    if (clean_path == NULL)
+
+    file_t* file = find_file(ctx, path, true);
+    if (file == NULL)
     {
-        return 0;
+        file = create_file(ctx, path);
     }
-    
-    if (len > 0 && clean_path[len - 1] == '/')
+    if (file == NULL)
     {
-        clean_path[len - 1] = '\0';
+        file_free_data(&data);
+        return DMFSI_ERR_NOT_FOUND;
     }
-    
-    if (strlen(clean_path) == 0)
+
+    bool busy = (file->pins > 0);
+    for (file_handle_t* handle = file->handles; handle != NULL; handle = handle->next)
     {
-        Dmod_Free(clean_path);
-        return 1;  // Root directory
+        busy |= (handle->reserved > 0);
     }
-    
-    dmfsi_path_t* p = dmfsi_path_create(clean_path);
-    Dmod_Free(clean_path);
-    
-    if (p == NULL)
+    if (busy)
     {
-        return 0;
+        rwlock_unlock(&file->lock, true);
+        DMOD_LOG_ERROR("dmramfs: Cannot replace the data of '%s' while it is mapped or reserved\n", path);
+        file_free_data(&data);
+        return DMFSI_ERR_INVALID;
     }
-    
-    dir_t* dir = find_dir(ctx->root_dir, p);
-    dmfsi_path_free(p);
-    
-    return (dir != NULL) ? 1 : 0;
-}
-
-// ============================================================================
-//                      Local Functions
-// ============================================================================
 
-/**
- * @brief Compare file path with a given path
- */
-static int compare_file_name(const void* file, const void* file_name)
-{
-    const file_t* file_a = (const file_t*)file;
-    const char* path_b = (const char*)file_name;
-    return strcmp(file_a->file_name, path_b);
+    file_free_data(file);
+    file_take_data(file, &data);
+    rwlock_unlock(&file->lock, true);
+    return DMFSI_OK;
 }
 
 /**
- * @brief Compare directory name with a given name
+ * @brief Queue operations for execution
+ * 
+ * An operation is only accepted if its completion is guaranteed a slot,
+ * so executing the queue never has to wait for the caller to reap.
+ * 
+ * @param ctx    The file system context
+ * @param batch  The operations to queue
+ * 
+ * @return size_t  The number of operations queued
  */
-static int compare_dir_name(const void* a, const void* b)
+static size_t queue_submit(dmfsi_context_t ctx, dmramfs_batch_t* batch)
 {
-    const dir_t* dir_a = (const dir_t*)a;
-    const char* name_b = (const char*)b;
-    // Assuming dir_t has a 'dir_name' member for comparison
-    return strcmp(dir_a->dir_name, name_b);
+    size_t queued = 0;
+    rwlock_lock(&ctx->queue_lock, true);
+    while (queued < batch->count)
+    {
+        size_t in_flight = ctx->submitted_count + ctx->completed_count + (ctx->processing ? 1 : 0);
+        if (in_flight >= DMRAMFS_QUEUE_SIZE || batch->ops[queued] == NULL)
+        {
+            break;
+        }
+        size_t tail = (ctx->submitted_head + ctx->submitted_count) % DMRAMFS_QUEUE_SIZE;
+        ctx->submitted[tail] = batch->ops[queued++];
+        ctx->submitted_count++;
+    }
+    rwlock_unlock(&ctx->queue_lock, true);
+    return queued;
 }
 
 /**
- * @brief Compare file handle pointers
+ * @brief Execute the queued operations in submission order
+ * 
+ * The queue lock is released while an operation runs, so submitting and
+ * reaping stay possible. Only one task executes the queue at a time.
+ * 
+ * @param ctx  The file system context
+ * 
+ * @return size_t  The number of operations executed
  */
-static int compare_handle_ptr(const void* a, const void* b)
+static size_t queue_process(dmfsi_context_t ctx)
 {
-    return (a == b) ? 0 : 1;
+    size_t processed = 0;
+    rwlock_lock(&ctx->queue_lock, true);
+    if (ctx->processing)
+    {
+        rwlock_unlock(&ctx->queue_lock, true);
+        return 0;
+    }
+    while (ctx->submitted_count > 0)
+    {
+        dmramfs_op_t* op = ctx->submitted[ctx->submitted_head];
+        ctx->submitted_head = (ctx->submitted_head + 1) % DMRAMFS_QUEUE_SIZE;
+        ctx->submitted_count--;
+        ctx->processing = true;
+        rwlock_unlock(&ctx->queue_lock, true);
+
+        queue_execute(ctx, op);
+        processed++;
+
+        rwlock_lock(&ctx->queue_lock, true);
+        size_t tail = (ctx->completed_head + ctx->completed_count) % DMRAMFS_QUEUE_SIZE;
+        ctx->completed[tail] = op;
+        ctx->completed_count++;
+    }
+    ctx->processing = false;
+    rwlock_unlock(&ctx->queue_lock, true);
+    return processed;
 }
 
 /**
- * @brief Compare file pointers
+ * @brief Collect completed operations
+ * 
+ * @param ctx    The file system context
+ * @param batch  Receives the completed operations (in completion order)
+ * 
+ * @return size_t  The number of operations reaped
  */
-static int compare_file_ptr(const void* a, const void* b)
+static size_t queue_reap(dmfsi_context_t ctx, dmramfs_batch_t* batch)
 {
-    return (a == b) ? 0 : 1;
+    size_t reaped = 0;
+    rwlock_lock(&ctx->queue_lock, true);
+    while (reaped < batch->count && ctx->completed_count > 0)
+    {
+        batch->ops[reaped++] = ctx->completed[ctx->completed_head];
+        ctx->completed_head = (ctx->completed_head + 1) % DMRAMFS_QUEUE_SIZE;
+        ctx->completed_count--;
+    }
+    rwlock_unlock(&ctx->queue_lock, true);
+    return reaped;
 }
 
 /**
- * @brief Find a file by its path
+ * @brief Execute a single queued operation
+ * 
+ * @param ctx  The file system context
+ * @param op   The operation; receives the result
  */
-static file_t* find_file(dir_t* dir, dmfsi_path_t* path)
+static void queue_execute(dmfsi_context_t ctx, dmramfs_op_t* op)
 {
-    if (dir == NULL || path == NULL)
+    void* fp = op->fp;
+    if (op->link != NULL)
     {
-        return NULL;
+        fp = (op->link->result == DMFSI_OK) ? op->link->fp : NULL;
     }
 
-    if(path->filename != NULL)
-    {
-        file_t* file = dmlist_find(dir->files, path->filename, compare_file_name);
-        return file;  // Return the found file (or NULL if not found)
-    }
-    else if(path->directory != NULL)
+    op->transferred = 0;
+    switch (op->opcode)
     {
-        // Handle empty directory (root path like /file.txt)
-        if (strlen(path->directory) == 0 && path->next != NULL)
-        {
-            return find_file(dir, path->next);
-        }
-        
-        dir_t* subdir = dmlist_find(dir->dirs, path->directory, compare_dir_name);
-        if(subdir != NULL && path->next != NULL)
+        case DMRAMFS_OP_OPEN:
+            op->result = dmfsi_dmramfs_fopen(ctx, &op->fp, op->path, op->mode, op->attr);
+            break;
+        case DMRAMFS_OP_CLOSE:
+            op->result = dmfsi_dmramfs_fclose(ctx, fp);
+            break;
+        case DMRAMFS_OP_READ:
+            op->result = dmfsi_dmramfs_fread(ctx, fp, op->buffer, op->size, &op->transferred);
+            break;
+        case DMRAMFS_OP_WRITE:
+            op->result = dmfsi_dmramfs_fwrite(ctx, fp, op->buffer, op->size, &op->transferred);
+            break;
+        case DMRAMFS_OP_PREAD:
+        case DMRAMFS_OP_PWRITE:
         {
-            return find_file(subdir, path->next);
+            dmramfs_io_t io = { op->offset, op->buffer, op->size, 0 };
+            int request = (op->opcode == DMRAMFS_OP_PREAD) ? DMRAMFS_IOCTL_PREAD : DMRAMFS_IOCTL_PWRITE;
+            op->result = dmfsi_dmramfs_ioctl(ctx, fp, request, &io);
+            op->transferred = io.transferred;
+            break;
         }
+        case DMRAMFS_OP_STAT:
+            op->result = dmfsi_dmramfs_stat(ctx, op->path, (dmfsi_stat_t*)op->buffer);
+            break;
+        default:
+            op->result = DMFSI_ERR_INVALID;
+            break;
     }
-    return NULL;
 }
 
 /**
- * @brief Find a directory by its path
+ * @brief Create a read-only snapshot of the mount
+ * 
+ * The snapshot is a separate mount with a copy of the directory tree; the
+ * file data is shared copy-on-write, so the snapshot costs memory for the
+ * metadata only, plus the extents modified afterwards. The snapshot barrier
+ * is held exclusively, so no modification runs while the tree is copied and
+ * all files are captured at the same point in time. Only writes through
+ * mapped views and reserved regions bypass the barrier.
+ * 
+ * @param ctx       The file system context
+ * @param snapshot  [out] The snapshot mount (released with _deinit)
+ * 
+ * @return int  DMFSI_OK on success, DMFSI_ERR_GENERAL if out of memory
  */
-static dir_t* find_dir(dir_t* dir, dmfsi_path_t* path)
+static int mount_snapshot(dmfsi_context_t ctx, dmfsi_context_t* snapshot)
 {
-    if (dir == NULL || path == NULL)
+    dmfsi_context_t copy = dmfsi_dmramfs_init(NULL);
+    if (copy == NULL)
     {
-        return NULL;
+        return DMFSI_ERR_GENERAL;
     }
+    copy->read_only = true;
 
-    // Handle case where path ends with a filename (treat as dir name for direxists)
-    const char* name = (path->directory != NULL) ? path->directory : path->filename;
-    if (name == NULL)
-    {
-        return NULL;
-    }
-    
-    // Handle empty directory (root path)
-    if (strlen(name) == 0 && path->next != NULL)
+    rwlock_lock(&ctx->barrier, true);
+    int result = snapshot_dir(ctx, copy, ctx->root_dir, copy->root_dir);
+    rwlock_unlock(&ctx->barrier, true);
+    if (result != DMFSI_OK)
     {
-        return find_dir(dir, path->next);
+        DMOD_LOG_ERROR("dmramfs: Failed to allocate memory for snapshot\n");
+        dmfsi_dmramfs_deinit(copy);
+        return DMFSI_ERR_GENERAL;
     }
+    *snapshot = copy;
+    return DMFSI_OK;
+}
 
-    dir_t* subdir = dmlist_find(dir->dirs, name, compare_dir_name);
-    if (subdir != NULL)
+/**
+ * @brief Copy the contents of a directory into a snapshot, recursively
+ * 
+ * Only one source directory is locked at a time: the children are copied
+ * under its lock and the subdirectories are descended into afterwards.
+ * 
+ * @param ctx       The file system context
+ * @param snapshot  The snapshot mount (not visible to other tasks yet)
+ * @param source    The directory to copy
+ * @param dir       The directory of the snapshot to fill
+ * 
+ * @return int  DMFSI_OK on success, DMFSI_ERR_GENERAL if out of memory
+ */
+static int snapshot_dir(dmfsi_context_t ctx, dmfsi_context_t snapshot, dir_t* source, dir_t* dir)
+{
+    int result = DMFSI_OK;
+    rwlock_lock(&source->lock, false);
+    for (entry_t* child = source->first_child; child != NULL && result == DMFSI_OK; child = child->next_sibling)
     {
-        if (path->next != NULL)
+        size_t len = strlen(child->name);
+        if (child->is_dir)
         {
-            return find_dir(subdir, path->next);
+            dir_t* copy = alloc_dir(snapshot, dir, child->name, len);
+            result = (copy != NULL) ? dir_add_child(snapshot, dir, &copy->entry) : DMFSI_ERR_GENERAL;
+            continue;
         }
-        else
+
+        file_t* copy = mount_alloc(snapshot, sizeof(file_t));
+        if (copy == NULL)
+        {
+            result = DMFSI_ERR_GENERAL;
+            break;
+        }
+        memset(copy, 0, sizeof(file_t));
+        copy->mount = snapshot;
+        copy->entry.parent = dir;
+        bool named = entry_init_name(snapshot, &copy->entry, child->name, len);
+        mount_add_file(snapshot, copy);  // Released by _deinit from now on
+
+        file_t* file = (file_t*)child;
+        rwlock_lock(&file->lock, false);
+        result = file_share_data(copy, file);
+        rwlock_unlock(&file->lock, false);
+        if (result == DMFSI_OK)
         {
-            return subdir;
+            result = named ? dir_add_child(snapshot, dir, &copy->entry) : DMFSI_ERR_GENERAL;
         }
     }
-    
-    return NULL;
+    rwlock_unlock(&source->lock, false);
+
+    // Directories are never removed, so each copied one can be found again
+    for (entry_t* child = dir->first_child; child != NULL && result == DMFSI_OK; child = child->next_sibling)
+    {
+        if (child->is_dir)
+        {
+            unsigned reader = epoch_enter(ctx);
+            dir_t* subdir = (dir_t*)index_find(&source->children, child->name, strlen(child->name), true);
+            epoch_exit(ctx, reader);
+            result = (subdir != NULL) ? snapshot_dir(ctx, snapshot, subdir, (dir_t*)child) : DMFSI_ERR_GENERAL;
+        }
+    }
+    return result;
 }
 
+#if DMRAMFS_DEDUP
 /**
- * @brief Create a file at the specified path
+ * @brief Replace the full extents of a file by identical shared ones
  * 
- * @param dir   The starting directory
- * @param path  The path to create the file at
+ * An extent with no identical one is added to the deduplication table, so
+ * the following files can share it. Extents already shared are skipped.
  * 
- * @return file_t*  Pointer to the created file, or NULL on failure
+ * @param file  The file to deduplicate (write-locked, with no handles)
  */
-static file_t* create_file(dir_t* dir, dmfsi_path_t* path)
+static void file_dedup(file_t* file)
 {
-    if(path->filename != NULL)
+    size_t full = file->size / DMRAMFS_EXTENT_SIZE;
+    extent_t** slot;
+    for (size_t i = 0; (slot = file_next_extent(file, &i, full)) != NULL; i++)
     {
-        file_t* file = Dmod_Malloc(sizeof(file_t));
-        if(file == NULL)
+        extent_t* extent = *slot;
+        if (extent->refs != 1)
         {
-            DMOD_LOG_ERROR("dmramfs: Failed to allocate memory for new file '%s'\n", path->filename);
-            return NULL;
+            continue;
         }
-        file->file_name = dmfsi_strndup(path->filename, strlen(path->filename));
-        file->data = NULL;
-        file->size = 0;
-        file->handles = dmlist_create(DMOD_MODULE_NAME);
-        if(!dmlist_insert(dir->files, 0, file))
+
+        uint32_t hash = hash_bytes(DMRAMFS_HASH_SEED, (const char*)extent->data, DMRAMFS_EXTENT_SIZE);
+        extent_t** bucket = &dedup_table[hash & (DMRAMFS_DEDUP_BUCKETS - 1)];
+        rwlock_lock(&dedup_lock, true);
+        extent_t* match = *bucket;
+        while (match != NULL && (match->hash != hash || memcmp(match->data, extent->data, DMRAMFS_EXTENT_SIZE) != 0))
         {
-            DMOD_LOG_ERROR("dmramfs: Failed to insert new file '%s' into directory\n", path->filename);
-            if (file->handles) dmlist_destroy(file->handles);
-            if (file->file_name) Dmod_Free(file->file_name);
-            Dmod_Free(file);
-            return NULL;
+            match = match->dedup_next;
         }
-        return file;
-    }
-    else if(path->directory != NULL)
-    {
-        // Handle empty directory (root path like /file.txt)
-        if (strlen(path->directory) == 0 && path->next != NULL)
+        if (match != NULL)
         {
-            return create_file(dir, path->next);
+            match->refs++;
+            *slot = match;
         }
-        
-        dir_t* subdir = dmlist_find(dir->dirs, path->directory, compare_dir_name);
-        if(subdir == NULL)
+        else
         {
-            DMOD_LOG_ERROR("dmramfs: Directory '%s' not found in path for file creation\n", path->directory);
-            return NULL;
+            extent->hash = hash;
+            extent->deduplicated = true;
+            extent->refs++;
+            extent->dedup_next = *bucket;
+            *bucket = extent;
         }
-        if(path->next != NULL)
+        rwlock_unlock(&dedup_lock, true);
+        if (match != NULL)
         {
-            return create_file(subdir, path->next);
+            extent_release(extent);
         }
     }
-    return NULL;
 }
 
 /**
- * @brief Create a file handle for the specified file
- * 
- * @param file      The file to create a handle for
- * @param mode      The mode to open the file with
- * @param attribute The attributes for the file handle
- * 
- * @return file_handle_t*  Pointer to the created file handle, or NULL on failure
+ * @brief Calculate the statistics of the deduplication table
  */
-static file_handle_t* create_file_handle(file_t* file, int mode, int attribute)
+static void dedup_stats(dmramfs_dedup_stats_t* stats)
 {
-    file_handle_t* handle = Dmod_Malloc(sizeof(file_handle_t));
-    if (handle == NULL)
-    {
-        DMOD_LOG_ERROR("dmramfs: Failed to allocate memory for file handle\n");
-        return NULL;
-    }
-
-    handle->file = file;
-    handle->mode = mode;
-    handle->attribute = attribute;
-    handle->position = 0;
-
-    // Handle truncate mode
-    if ((mode & DMFSI_O_TRUNC) && file != NULL)
+    stats->blocks = 0;
+    stats->references = 0;
+    rwlock_lock(&dedup_lock, false);
+    for (size_t i = 0; i < DMRAMFS_DEDUP_BUCKETS; i++)
     {
-        if (file->data)
+        for (extent_t* extent = dedup_table[i]; extent != NULL; extent = extent->dedup_next)
         {
-            Dmod_Free(file->data);
-            file->data = NULL;
+            stats->blocks++;
+            stats->references += extent->refs - 1;
         }
-        file->size = 0;
     }
+    rwlock_unlock(&dedup_lock, false);
+    stats->block_size = DMRAMFS_EXTENT_SIZE;
+}
+#endif
 
-    // Handle append mode - start at end of file
-    if ((mode & DMFSI_O_APPEND) && file != NULL)
-    {
-        handle->position = file->size;
-    }
+#if DMRAMFS_COMPRESS
+/**
+ * @brief Get a byte of the data stored by a file
+ */
+static unsigned char* file_byte(file_t* file, size_t offset)
+{
+    return file_data_at(file, offset, NULL);
+}
 
-    if(!dmlist_push_back(file->handles, handle))
+/**
+ * @brief Append the continuation bytes of a length of 15 or more to compressed data
+ */
+static int lz_put_length(file_t* packed, size_t length)
+{
+    unsigned char bytes[16];
+    size_t count = 0;
+    int result = DMFSI_OK;
+    length -= 15;
+    while (result == DMFSI_OK)
     {
-        DMOD_LOG_ERROR("dmramfs: Failed to add handle to file's handle list\n");
-        Dmod_Free(handle);
-        return NULL;
+        unsigned char byte = (unsigned char)((length < 255) ? length : 255);
+        bytes[count++] = byte;
+        length -= byte;
+        if (byte < 255 || count == sizeof(bytes))
+        {
+            result = file_write(packed, packed->size, bytes, count);
+            count = 0;
+        }
+        if (byte < 255)
+        {
+            break;
+        }
     }
-
-    return handle;
+    return result;
 }
 
 /**
- * @brief Create the root directory
+ * @brief Append a sequence (literals followed by a match) to compressed data
  * 
- * @return dir_t*  Pointer to the created root directory, or NULL on failure
+ * The format follows LZ4 blocks: a token with the literal length and the
+ * match length in its nibbles (15 continues with bytes of up to 255), the
+ * literals, the 16-bit little endian match offset. The last sequence has
+ * no match.
+ * 
+ * @param packed       The compressed data to append to
+ * @param file         The file being compressed
+ * @param literal      The offset of the literals in the file
+ * @param literal_len  The number of literals
+ * @param offset       The distance of the match (0 for the last sequence)
+ * @param match_len    The length of the match
+ * 
+ * @return int  DMFSI_OK on success, DMFSI_ERR_GENERAL if out of memory
  */
-static dir_t* create_root_dir(void)
+static int lz_emit(file_t* packed, file_t* file, size_t literal, size_t literal_len, size_t offset, size_t match_len)
 {
-    dir_t* root = Dmod_Malloc(sizeof(dir_t));
-    if (root == NULL)
+    size_t match_code = (offset > 0) ? match_len - DMRAMFS_LZ_MIN_MATCH : 0;
+    unsigned char token = (unsigned char)(((literal_len < 15) ? literal_len : 15) << 4 | ((match_code < 15) ? match_code : 15));
+    int result = file_write(packed, packed->size, &token, 1);
+    if (result == DMFSI_OK && literal_len >= 15)
     {
-        DMOD_LOG_ERROR("dmramfs: Failed to allocate memory for root directory\n");
-        return NULL;
+        result = lz_put_length(packed, literal_len);
     }
 
-    root->dir_name = dmfsi_strndup("/", 1);
-    root->files = dmlist_create(DMOD_MODULE_NAME);
-    root->dirs = dmlist_create(DMOD_MODULE_NAME);
-
-    if (root->dir_name == NULL || root->files == NULL || root->dirs == NULL)
+    unsigned char chunk[64];
+    for (size_t done = 0; done < literal_len && result == DMFSI_OK; )
     {
-        DMOD_LOG_ERROR("dmramfs: Failed to initialize root directory\n");
-        if (root->dir_name) Dmod_Free(root->dir_name);
-        if (root->files) dmlist_destroy(root->files);
-        if (root->dirs) dmlist_destroy(root->dirs);
-        Dmod_Free(root);
-        return NULL;
+        size_t n = file_read_at(file, literal + done, chunk, (literal_len - done < sizeof(chunk)) ? literal_len - done : sizeof(chunk));
+        result = file_write(packed, packed->size, chunk, n);
+        done += n;
     }
 
-    return root;
+    if (result == DMFSI_OK && offset > 0)
+    {
+        unsigned char distance[2] = { (unsigned char)(offset & 0xFF), (unsigned char)(offset >> 8) };
+        result = file_write(packed, packed->size, distance, sizeof(distance));
+        if (result == DMFSI_OK && match_code >= 15)
+        {
+            result = lz_put_length(packed, match_code);
+        }
+    }
+    return result;
 }
 
 /**
- * @brief Create a directory at the specified path
+ * @brief Compress the data of a file
+ * 
+ * The compressed data is stored in new extents, so no buffer of the size
+ * of the file is needed. Files sharing extents with other files are
+ * skipped, as well as files that would not shrink by at least one extent.
  * 
- * @param parent  The parent directory
- * @param path    The path to create the directory at
+ * @param file  The file to compress (write-locked, with no handles)
  * 
- * @return dir_t*  Pointer to the created directory, or NULL on failure
+ * @return int  DMFSI_OK if the file was compressed, DMFSI_ERR_INVALID if it was skipped,
+ *              DMFSI_ERR_GENERAL if out of memory
  */
-static dir_t* create_dir(dir_t* parent, dmfsi_path_t* path)
+static int file_pack(file_t* file)
 {
-    if (path == NULL || parent == NULL)
+    size_t size = file->size;
+    size_t used = (size + DMRAMFS_EXTENT_SIZE - 1) / DMRAMFS_EXTENT_SIZE;
+    if (file->packed_size > 0 || used < 2)
     {
-        return NULL;
+        return DMFSI_ERR_INVALID;
     }
-
-    // If this is a filename entry, treat it as a directory name (for mkdir with no trailing slash)
-    const char* name = (path->filename != NULL) ? path->filename : path->directory;
-    if (name == NULL)
+    for (size_t i = 0; i < used; i++)
     {
-        return NULL;
+        // Holes take no memory already, and unpacking would allocate them
+        extent_t* extent = file_extent(file, i);
+        if (extent == NULL)
+        {
+            return DMFSI_ERR_INVALID;
+        }
+        // Releasing an extent shared with other files would not save anything
+        uint32_t owners = extent->refs;
+#if DMRAMFS_DEDUP
+        owners -= extent->deduplicated ? 1 : 0;
+#endif
+        if (owners != 1)
+        {
+            return DMFSI_ERR_INVALID;
+        }
     }
-    
-    // Handle empty directory (root path)
-    if (strlen(name) == 0 && path->next != NULL)
+
+    uint32_t* table = Dmod_Malloc(sizeof(uint32_t) << DMRAMFS_LZ_HASH_BITS);
+    if (table == NULL)
     {
-        return create_dir(parent, path->next);
+        return DMFSI_ERR_GENERAL;
     }
+    memset(table, 0xFF, sizeof(uint32_t) << DMRAMFS_LZ_HASH_BITS);
 
-    // Check if it's the final component
-    if (path->filename != NULL || path->next == NULL)
+    file_t packed;
+    memset(&packed, 0, sizeof(file_t));
+    packed.mount = file->mount;
+    size_t limit = (used - 1) * DMRAMFS_EXTENT_SIZE;
+    size_t anchor = 0;
+    size_t position = 0;
+    int result = DMFSI_OK;
+    while (position + DMRAMFS_LZ_MIN_MATCH <= size && result == DMFSI_OK)
     {
-        // Check if directory already exists
-        dir_t* existing = dmlist_find(parent->dirs, name, compare_dir_name);
-        if (existing != NULL)
+        uint32_t sequence = 0;
+        for (size_t i = 0; i < DMRAMFS_LZ_MIN_MATCH; i++)
         {
-            return existing;
+            sequence = (sequence << 8) | *file_byte(file, position + i);
         }
+        uint32_t slot = (sequence * 2654435761u) >> (32 - DMRAMFS_LZ_HASH_BITS);
+        size_t candidate = table[slot];
+        table[slot] = (uint32_t)position;
 
-        // Create new directory
-        dir_t* new_dir = Dmod_Malloc(sizeof(dir_t));
-        if (new_dir == NULL)
+        size_t length = 0;
+        if (candidate < position && position - candidate <= DMRAMFS_LZ_MAX_OFFSET)
         {
-            DMOD_LOG_ERROR("dmramfs: Failed to allocate memory for directory '%s'\n", name);
-            return NULL;
+            while (position + length < size
+                   && *file_byte(file, candidate + length) == *file_byte(file, position + length))
+            {
+                length++;
+            }
         }
-
-        new_dir->dir_name = dmfsi_strndup(name, strlen(name));
-        new_dir->files = dmlist_create(DMOD_MODULE_NAME);
-        new_dir->dirs = dmlist_create(DMOD_MODULE_NAME);
-
-        if (new_dir->dir_name == NULL || new_dir->files == NULL || new_dir->dirs == NULL)
+        if (length < DMRAMFS_LZ_MIN_MATCH)
         {
-            DMOD_LOG_ERROR("dmramfs: Failed to initialize directory '%s'\n", name);
-            if (new_dir->dir_name) Dmod_Free(new_dir->dir_name);
-            if (new_dir->files) dmlist_destroy(new_dir->files);
-            if (new_dir->dirs) dmlist_destroy(new_dir->dirs);
-            Dmod_Free(new_dir);
-            return NULL;
+            position++;
+            continue;
         }
 
-        if (!dmlist_insert(parent->dirs, 0, new_dir))
+        result = lz_emit(&packed, file, anchor, position - anchor, position - candidate, length);
+        position += length;
+        anchor = position;
+        if (packed.size > limit)
         {
-            DMOD_LOG_ERROR("dmramfs: Failed to insert directory '%s' into parent\n", name);
-            if (new_dir->dir_name) Dmod_Free(new_dir->dir_name);
-            if (new_dir->files) dmlist_destroy(new_dir->files);
-            if (new_dir->dirs) dmlist_destroy(new_dir->dirs);
-            Dmod_Free(new_dir);
-            return NULL;
+            result = DMFSI_ERR_INVALID;
         }
-
-        return new_dir;
     }
-    else
+    Dmod_Free(table);
+    if (result == DMFSI_OK)
     {
-        // Navigate to or create intermediate directory
-        dir_t* subdir = dmlist_find(parent->dirs, name, compare_dir_name);
-        if (subdir == NULL)
-        {
-            // Create intermediate directory
-            subdir = Dmod_Malloc(sizeof(dir_t));
-            if (subdir == NULL)
-            {
-                return NULL;
-            }
-
-            subdir->dir_name = dmfsi_strndup(name, strlen(name));
-            subdir->files = dmlist_create(DMOD_MODULE_NAME);
-            subdir->dirs = dmlist_create(DMOD_MODULE_NAME);
-
-            if (!dmlist_insert(parent->dirs, 0, subdir))
-            {
-                if (subdir->dir_name) Dmod_Free(subdir->dir_name);
-                if (subdir->files) dmlist_destroy(subdir->files);
-                if (subdir->dirs) dmlist_destroy(subdir->dirs);
-                Dmod_Free(subdir);
-                return NULL;
-            }
-        }
-
-        return create_dir(subdir, path->next);
+        result = lz_emit(&packed, file, anchor, size - anchor, 0, 0);
+    }
+    if (result == DMFSI_OK && packed.size > limit)
+    {
+        result = DMFSI_ERR_INVALID;
+    }
+    if (result != DMFSI_OK)
+    {
+        file_free_data(&packed);
+        return result;
     }
+
+    file_shrink(&packed, 0);
+    file_free_data(file);
+    file_take_data(file, &packed);
+    file->packed_size = packed.size;
+    file->size = size;
+    return DMFSI_OK;
 }
 
 /**
- * @brief Free a file and all its resources
+ * @brief Decompress the data of a file
  * 
- * @param file  The file to free
+ * @param file  The compressed file (write-locked)
+ * 
+ * @return int  DMFSI_OK on success, DMFSI_ERR_GENERAL if out of memory or the data is corrupted
  */
-static void free_file(file_t* file)
+static int file_unpack(file_t* file)
 {
-    if (file == NULL)
-    {
-        return;
-    }
-
-    if (file->file_name)
+    file_t plain;
+    memset(&plain, 0, sizeof(file_t));
+    plain.mount = file->mount;
+    if (file_reserve(&plain, 0, file->size) != DMFSI_OK)
     {
-        Dmod_Free(file->file_name);
+        file_free_data(&plain);
+        return DMFSI_ERR_GENERAL;
     }
 
-    if (file->data)
+    size_t in = 0;
+    size_t out = 0;
+    bool valid = true;
+    while (in < file->packed_size && valid)
     {
-        Dmod_Free(file->data);
-    }
+        unsigned token = *file_byte(file, in++);
+        size_t literal_len = token >> 4;
+        unsigned char extra = 255;
+        while (literal_len >= 15 && extra == 255 && in < file->packed_size)
+        {
+            extra = *file_byte(file, in++);
+            literal_len += extra;
+            if (extra < 255)
+            {
+                break;
+            }
+        }
+        valid = (literal_len <= file->packed_size - in && literal_len <= file->size - out);
+        for (size_t i = 0; i < literal_len && valid; i++)
+        {
+            *file_byte(&plain, out++) = *file_byte(file, in++);
+        }
+        if (!valid || in == file->packed_size)
+        {
+            break;
+        }
 
-    if (file->handles)
-    {
-        // Free all handles
-        while (dmlist_size(file->handles) > 0)
+        // Match (the data may overlap, so it is copied byte by byte)
+        valid = (file->packed_size - in >= 2);
+        size_t offset = valid ? (size_t)*file_byte(file, in) | ((size_t)*file_byte(file, in + 1) << 8) : 0;
+        in += 2;
+        size_t match_len = token & 0x0F;
+        extra = 255;
+        while (valid && match_len >= 15 && extra == 255 && in < file->packed_size)
+        {
+            extra = *file_byte(file, in++);
+            match_len += extra;
+            if (extra < 255)
+            {
+                break;
+            }
+        }
+        match_len += DMRAMFS_LZ_MIN_MATCH;
+        valid = valid && offset > 0 && offset <= out && match_len <= file->size - out;
+        for (size_t i = 0; i < match_len && valid; i++, out++)
         {
-            file_handle_t* handle = (file_handle_t*)dmlist_front(file->handles);
-            dmlist_pop_front(file->handles);
-            if (handle) Dmod_Free(handle);
+            *file_byte(&plain, out) = *file_byte(&plain, out - offset);
         }
-        dmlist_destroy(file->handles);
+    }
+    if (!valid || out != file->size)
+    {
+        DMOD_LOG_ERROR("dmramfs: Corrupted compressed file data\n");
+        file_free_data(&plain);
+        return DMFSI_ERR_GENERAL;
     }
 
-    Dmod_Free(file);
+    plain.size = file->size;
+    file_free_data(file);
+    file_take_data(file, &plain);
+    return DMFSI_OK;
 }
 
 /**
- * @brief Free a directory and all its contents recursively
+ * @brief Compress the cold files of the mount and collect the compression statistics
+ * 
+ * Directories are never freed and new ones are only prepended to the
+ * mount-wide list, so the list is walked without the mount lock.
  * 
- * @param dir  The directory to free
+ * @param ctx       The file system context
+ * @param compress  true to compress the cold files, false to only collect the statistics
+ * @param stats     [out] The compression statistics
  */
-static void free_dir(dir_t* dir)
+static void mount_compress(dmfsi_context_t ctx, bool compress, dmramfs_compress_stats_t* stats)
 {
-    if (dir == NULL)
-    {
-        return;
-    }
+    memset(stats, 0, sizeof(dmramfs_compress_stats_t));
+    rwlock_lock(&ctx->mount_lock, true);
+    dir_t* dirs = ctx->dirs;
+    rwlock_unlock(&ctx->mount_lock, true);
 
-    // Free all files
-    if (dir->files)
+    uint32_t clock = DMRAMFS_COMPRESS_CLOCK(ctx);
+    uint32_t cold_age = DMRAMFS_COMPRESS_AGE;
+    for (dir_t* dir = dirs; dir != NULL; dir = dir->mount_next)
     {
-        while (dmlist_size(dir->files) > 0)
+        rwlock_lock(&dir->lock, false);
+        for (entry_t* child = dir->first_child; child != NULL; child = child->next_sibling)
         {
-            file_t* file = (file_t*)dmlist_front(dir->files);
-            dmlist_pop_front(dir->files);
-            free_file(file);
-        }
-        dmlist_destroy(dir->files);
-    }
-
-    // Free all subdirectories recursively
-    if (dir->dirs)
-    {
-        while (dmlist_size(dir->dirs) > 0)
-        {
-            dir_t* subdir = (dir_t*)dmlist_front(dir->dirs);
-            dmlist_pop_front(dir->dirs);
-            free_dir(subdir);
+            if (child->is_dir)
+            {
+                continue;
+            }
+            file_t* file = (file_t*)child;
+            rwlock_lock(&file->lock, compress);
+            if (compress && file->handles == NULL && clock - file->last_used >= cold_age)
+            {
+                file_pack(file);
+            }
+            if (file->packed_size > 0)
+            {
+                stats->files++;
+                stats->raw_bytes += file->size;
+                stats->packed_bytes += file->packed_size;
+            }
+            rwlock_unlock(&file->lock, compress);
         }
-        dmlist_destroy(dir->dirs);
-    }
-
-    if (dir->dir_name)
-    {
-        Dmod_Free(dir->dir_name);
+        rwlock_unlock(&dir->lock, false);
     }
-
-    Dmod_Free(dir);
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,142 @@
+/**
+ * @brief A clone shares the data of its source copy-on-write
+ */
+#include "test_common.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define TEST_SIZE   (3 * DMRAMFS_EXTENT_SIZE + 7)
+#define TEST_ROUNDS 2000
+
+static dmfsi_context_t ctx;
+
+/**
+ * @brief Check that a file holds exactly @p size bytes of @p data
+ */
+static void check_file(const char* path, const char* data, size_t size)
+{
+    static char check[2 * TEST_SIZE];
+    void* fp = test_open(ctx, path, DMFSI_O_RDONLY);
+    CHECK(dmfsi_dmramfs_size(ctx, fp) == (long)size);
+    CHECK(test_pread(ctx, fp, 0, check, sizeof(check)) == size);
+    CHECK(memcmp(check, data, size) == 0);
+    dmfsi_dmramfs_fclose(ctx, fp);
+}
+
+/**
+ * @brief Write a positional range, failing the test on error
+ */
+static void test_pwrite(void* fp, size_t offset, const void* buffer, size_t size)
+{
+    dmramfs_io_t io = { .offset = offset, .buffer = (void*)buffer, .size = size };
+    CHECK(dmfsi_dmramfs_ioctl(ctx, fp, DMRAMFS_IOCTL_PWRITE, &io) == DMFSI_OK);
+}
+
+#if !defined(DMRAMFS_THREAD_SAFE) || DMRAMFS_THREAD_SAFE
+/**
+ * @brief Fill /live with one round number after the other, each by a single write
+ */
+static void* writer(void* arg)
+{
+    static uint32_t rounds[TEST_SIZE / sizeof(uint32_t)];
+    void* fp = test_open(ctx, "/live", DMFSI_O_RDWR);
+    for (uint32_t round = 1; round <= TEST_ROUNDS; round++)
+    {
+        for (size_t i = 0; i < sizeof(rounds) / sizeof(rounds[0]); i++)
+        {
+            rounds[i] = round;
+        }
+        test_pwrite(fp, 0, rounds, sizeof(rounds));
+    }
+    dmfsi_dmramfs_fclose(ctx, fp);
+    atomic_store((atomic_bool*)arg, true);
+    return NULL;
+}
+#endif
+
+int main(void)
+{
+    ctx = dmfsi_dmramfs_init(NULL);
+    CHECK(ctx != NULL);
+    static char data[TEST_SIZE];
+    static char other[2 * TEST_SIZE];
+    for (size_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = (char)('a' + i % 23);
+    }
+    memset(other, 'o', sizeof(other));
+    void* source = test_open(ctx, "/source", DMFSI_O_CREAT | DMFSI_O_RDWR);
+    test_write(ctx, source, data, sizeof(data));
+
+    // Writes to the source after the clone and to the clone stay apart
+    CHECK(dmfsi_dmramfs_ioctl(ctx, source, DMRAMFS_IOCTL_CLONE, "/clone") == DMFSI_OK);
+    test_pwrite(source, DMRAMFS_EXTENT_SIZE, "source", 6);
+    check_file("/clone", data, sizeof(data));
+    void* clone = test_open(ctx, "/clone", DMFSI_O_RDWR);
+    test_pwrite(clone, 0, "clone", 5);
+    dmfsi_dmramfs_fclose(ctx, clone);
+    test_pwrite(source, DMRAMFS_EXTENT_SIZE, &data[DMRAMFS_EXTENT_SIZE], 6);
+    check_file("/source", data, sizeof(data));
+
+    // An existing target is replaced, an open one through its handles as well
+    void* target = test_open(ctx, "/existing", DMFSI_O_CREAT | DMFSI_O_RDWR);
+    test_write(ctx, target, other, sizeof(other));
+    dmfsi_dmramfs_fclose(ctx, target);
+    CHECK(dmfsi_dmramfs_ioctl(ctx, source, DMRAMFS_IOCTL_CLONE, "/existing") == DMFSI_OK);
+    check_file("/existing", data, sizeof(data));
+    target = test_open(ctx, "/open", DMFSI_O_CREAT | DMFSI_O_RDWR);
+    test_write(ctx, target, other, sizeof(other));
+    CHECK(dmfsi_dmramfs_lseek(ctx, target, 0, DMFSI_SEEK_SET) == 0);
+    CHECK(dmfsi_dmramfs_getc(ctx, target) == 'o');
+    CHECK(dmfsi_dmramfs_ioctl(ctx, source, DMRAMFS_IOCTL_CLONE, "/open") == DMFSI_OK);
+    CHECK(dmfsi_dmramfs_getc(ctx, target) == data[1]);
+    CHECK(dmfsi_dmramfs_putc(ctx, target, 'X') == 'X');
+    dmfsi_dmramfs_fclose(ctx, target);
+    check_file("/source", data, sizeof(data));
+
+    // Cloning a file onto its own path keeps its data
+    CHECK(dmfsi_dmramfs_ioctl(ctx, source, DMRAMFS_IOCTL_CLONE, "/source") == DMFSI_OK);
+    check_file("/source", data, sizeof(data));
+
+    // A target with a mapped view is refused and left unchanged
+    target = test_open(ctx, "/mapped", DMFSI_O_CREAT | DMFSI_O_RDWR);
+    test_write(ctx, target, other, sizeof(other));
+    dmramfs_map_t map = { .offset = 0 };
+    CHECK(dmfsi_dmramfs_ioctl(ctx, target, DMRAMFS_IOCTL_MAP, &map) == DMFSI_OK);
+    CHECK(dmfsi_dmramfs_ioctl(ctx, source, DMRAMFS_IOCTL_CLONE, "/mapped") == DMFSI_ERR_INVALID);
+    CHECK(memcmp(map.data, other, map.length) == 0);
+    CHECK(dmfsi_dmramfs_ioctl(ctx, target, DMRAMFS_IOCTL_UNMAP, NULL) == DMFSI_OK);
+    check_file("/mapped", other, sizeof(other));
+    CHECK(dmfsi_dmramfs_ioctl(ctx, source, DMRAMFS_IOCTL_CLONE, "/mapped") == DMFSI_OK);
+    dmfsi_dmramfs_fclose(ctx, target);
+    check_file("/mapped", data, sizeof(data));
+    dmfsi_dmramfs_fclose(ctx, source);
+
+#if !defined(DMRAMFS_THREAD_SAFE) || DMRAMFS_THREAD_SAFE
+    // A clone taken while the source is written holds a single round
+    void* live = test_open(ctx, "/live", DMFSI_O_CREAT | DMFSI_O_RDWR);
+    uint32_t zero[TEST_SIZE / sizeof(uint32_t)] = { 0 };
+    test_write(ctx, live, zero, sizeof(zero));
+    atomic_bool done = false;
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, writer, (void*)&done) == 0);
+    static uint32_t rounds[TEST_SIZE / sizeof(uint32_t)];
+    while (!atomic_load(&done))
+    {
+        CHECK(dmfsi_dmramfs_ioctl(ctx, live, DMRAMFS_IOCTL_CLONE, "/frozen") == DMFSI_OK);
+        void* fp = test_open(ctx, "/frozen", DMFSI_O_RDONLY);
+        CHECK(test_pread(ctx, fp, 0, rounds, sizeof(rounds)) == sizeof(rounds));
+        dmfsi_dmramfs_fclose(ctx, fp);
+        for (size_t i = 1; i < sizeof(rounds) / sizeof(rounds[0]); i++)
+        {
+            CHECK(rounds[i] == rounds[0]);
+        }
+    }
+    pthread_join(thread, NULL);
+    dmfsi_dmramfs_fclose(ctx, live);
+#endif
+
+    dmfsi_dmramfs_deinit(ctx);
+    return 0;
+}
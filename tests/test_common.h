@@ -0,0 +1,79 @@
+#ifndef TEST_COMMON_H
+#define TEST_COMMON_H
+
+#include "dmod.h"
+#include "dmfsi.h"
+#include "dmramfs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ============================================================================
+//                      dmramfs Interface
+// ============================================================================
+dmfsi_context_t dmfsi_dmramfs_init      (const char* config);
+int             dmfsi_dmramfs_deinit    (dmfsi_context_t ctx);
+int             dmfsi_dmramfs_fopen     (dmfsi_context_t ctx, void** fp, const char* path, int mode, int attr);
+int             dmfsi_dmramfs_fclose    (dmfsi_context_t ctx, void* fp);
+int             dmfsi_dmramfs_fread     (dmfsi_context_t ctx, void* fp, void* buffer, size_t size, size_t* read);
+int             dmfsi_dmramfs_fwrite    (dmfsi_context_t ctx, void* fp, const void* buffer, size_t size, size_t* written);
+long            dmfsi_dmramfs_lseek     (dmfsi_context_t ctx, void* fp, long offset, int whence);
+int             dmfsi_dmramfs_getc      (dmfsi_context_t ctx, void* fp);
+int             dmfsi_dmramfs_putc      (dmfsi_context_t ctx, void* fp, int c);
+int             dmfsi_dmramfs_ioctl     (dmfsi_context_t ctx, void* fp, int request, void* arg);
+long            dmfsi_dmramfs_size      (dmfsi_context_t ctx, void* fp);
+int             dmfsi_dmramfs_stat      (dmfsi_context_t ctx, const char* path, dmfsi_stat_t* stat);
+int             dmfsi_dmramfs_unlink    (dmfsi_context_t ctx, const char* path);
+int             dmfsi_dmramfs_rename    (dmfsi_context_t ctx, const char* oldpath, const char* newpath);
+int             dmfsi_dmramfs_mkdir     (dmfsi_context_t ctx, const char* path, int mode);
+int             dmfsi_dmramfs_opendir   (dmfsi_context_t ctx, void** dp, const char* path);
+int             dmfsi_dmramfs_closedir  (dmfsi_context_t ctx, void* dp);
+int             dmfsi_dmramfs_readdir   (dmfsi_context_t ctx, void* dp, dmfsi_dir_entry_t* entry);
+
+// ============================================================================
+//                      Test Helpers
+// ============================================================================
+/**
+ * @brief Fail the test with the location of the check if the condition is false
+ */
+#define CHECK(condition)                                                        \
+    do                                                                          \
+    {                                                                           \
+        if (!(condition))                                                       \
+        {                                                                       \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            exit(1);                                                            \
+        }                                                                       \
+    } while (0)
+
+/**
+ * @brief Open a file, failing the test if it cannot be opened
+ */
+static inline void* test_open(dmfsi_context_t ctx, const char* path, int mode)
+{
+    void* fp = NULL;
+    CHECK(dmfsi_dmramfs_fopen(ctx, &fp, path, mode, 0) == DMFSI_OK);
+    return fp;
+}
+
+/**
+ * @brief Write a whole buffer at the handle position, failing the test on error
+ */
+static inline void test_write(dmfsi_context_t ctx, void* fp, const void* buffer, size_t size)
+{
+    size_t written = 0;
+    CHECK(dmfsi_dmramfs_fwrite(ctx, fp, buffer, size, &written) == DMFSI_OK);
+    CHECK(written == size);
+}
+
+/**
+ * @brief Read at an explicit offset, returning the number of bytes read
+ */
+static inline size_t test_pread(dmfsi_context_t ctx, void* fp, size_t offset, void* buffer, size_t size)
+{
+    dmramfs_io_t io = { .offset = offset, .buffer = buffer, .size = size };
+    CHECK(dmfsi_dmramfs_ioctl(ctx, fp, DMRAMFS_IOCTL_PREAD, &io) == DMFSI_OK);
+    return io.transferred;
+}
+
+#endif // TEST_COMMON_H
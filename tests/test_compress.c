@@ -0,0 +1,107 @@
+/**
+ * @brief Cold files are compressed by the worker and read back unchanged
+ */
+#include "test_common.h"
+#include <stdint.h>
+
+#ifndef DMRAMFS_DEDUP
+#   define DMRAMFS_DEDUP 0
+#endif
+
+/**
+ * @brief Number of the all-zero files compressed (deduplicated ones share their extents and are skipped)
+ */
+#define PACKED_ZERO_FILES(count) (DMRAMFS_DEDUP ? 0 : (count))
+
+/**
+ * @brief Write @p size bytes to a new file and close it
+ */
+static void create_file(dmfsi_context_t ctx, const char* path, const char* data, size_t size)
+{
+    void* fp = test_open(ctx, path, DMFSI_O_CREAT | DMFSI_O_RDWR);
+    test_write(ctx, fp, data, size);
+    dmfsi_dmramfs_fclose(ctx, fp);
+}
+
+/**
+ * @brief Read a whole file through fread and compare it with @p data
+ */
+static void check_file(dmfsi_context_t ctx, const char* path, const char* data, size_t size)
+{
+    static char check[8 * DMRAMFS_EXTENT_SIZE];
+    void* fp = test_open(ctx, path, DMFSI_O_RDONLY);
+    CHECK(dmfsi_dmramfs_size(ctx, fp) == (long)size);
+    size_t read = 0;
+    CHECK(dmfsi_dmramfs_fread(ctx, fp, check, sizeof(check), &read) == DMFSI_OK);
+    CHECK(read == size);
+    CHECK(memcmp(check, data, size) == 0);
+    dmfsi_dmramfs_fclose(ctx, fp);
+}
+
+/**
+ * @brief Number of compressed files of the mount
+ */
+static size_t packed_files(dmfsi_context_t ctx, dmramfs_compress_stats_t* stats)
+{
+    CHECK(dmfsi_dmramfs_ioctl(ctx, NULL, DMRAMFS_IOCTL_COMPRESS_STATS, stats) == DMFSI_OK);
+    return stats->files;
+}
+
+int main(void)
+{
+    dmfsi_context_t ctx = dmfsi_dmramfs_init(NULL);
+    CHECK(ctx != NULL);
+
+    // Incompressible, all-zero and repetitive data with matches crossing extents
+    static char noise[8 * DMRAMFS_EXTENT_SIZE];
+    static char zero[8 * DMRAMFS_EXTENT_SIZE];
+    static char text[5 * DMRAMFS_EXTENT_SIZE + 123];
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < sizeof(noise); i++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        noise[i] = (char)(seed >> 24);
+    }
+    for (size_t i = 0; i < sizeof(text); )
+    {
+        i += (size_t)snprintf(&text[i], sizeof(text) - i, "record %zu of the log\n", i / 37);
+    }
+    create_file(ctx, "/noise", noise, sizeof(noise));
+    create_file(ctx, "/zero", zero, sizeof(zero));
+    create_file(ctx, "/text", text, sizeof(text) - 1);
+    void* open_fp = test_open(ctx, "/open", DMFSI_O_CREAT | DMFSI_O_RDWR);
+    test_write(ctx, open_fp, zero, sizeof(zero));
+
+    // Files are not compressed until they are cold, even with an idle worker
+    dmramfs_compress_stats_t stats;
+    for (int tick = 1; tick < DMRAMFS_COMPRESS_AGE; tick++)
+    {
+        CHECK(dmfsi_dmramfs_ioctl(ctx, NULL, DMRAMFS_IOCTL_PROCESS, NULL) == DMFSI_OK);
+        CHECK(packed_files(ctx, &stats) == 0);
+    }
+
+    // The next idle pass compresses the cold files, skipping the open and incompressible ones
+    CHECK(dmfsi_dmramfs_ioctl(ctx, NULL, DMRAMFS_IOCTL_PROCESS, NULL) == DMFSI_OK);
+    CHECK(packed_files(ctx, &stats) == 1 + PACKED_ZERO_FILES(1));
+    CHECK(stats.raw_bytes == PACKED_ZERO_FILES(1) * sizeof(zero) + sizeof(text) - 1);
+    CHECK(stats.packed_bytes < stats.raw_bytes / 4);
+
+    // The data is decompressed unchanged when the files are opened again
+    check_file(ctx, "/noise", noise, sizeof(noise));
+    check_file(ctx, "/zero", zero, sizeof(zero));
+    check_file(ctx, "/text", text, sizeof(text) - 1);
+    CHECK(packed_files(ctx, &stats) == 0);
+    dmfsi_dmramfs_fclose(ctx, open_fp);
+    check_file(ctx, "/open", zero, sizeof(zero));
+
+    // An explicit compression ages the files the same way
+    for (int tick = 0; tick < DMRAMFS_COMPRESS_AGE; tick++)
+    {
+        CHECK(dmfsi_dmramfs_ioctl(ctx, NULL, DMRAMFS_IOCTL_COMPRESS, NULL) == DMFSI_OK);
+    }
+    CHECK(packed_files(ctx, &stats) == 1 + PACKED_ZERO_FILES(2));
+    check_file(ctx, "/text", text, sizeof(text) - 1);
+
+    dmfsi_dmramfs_deinit(ctx);
+    return 0;
+}
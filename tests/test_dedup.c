@@ -0,0 +1,76 @@
+/**
+ * @brief Identical full extents of closed files are shared copy-on-write
+ */
+#include "test_common.h"
+
+#define BLOCKS 4
+
+/**
+ * @brief Write @p size bytes to a new file and close it
+ */
+static void create_file(dmfsi_context_t ctx, const char* path, const char* data, size_t size)
+{
+    void* fp = test_open(ctx, path, DMFSI_O_CREAT | DMFSI_O_RDWR);
+    test_write(ctx, fp, data, size);
+    dmfsi_dmramfs_fclose(ctx, fp);
+}
+
+/**
+ * @brief Read the deduplication statistics
+ */
+static dmramfs_dedup_stats_t dedup_stats(dmfsi_context_t ctx)
+{
+    dmramfs_dedup_stats_t stats;
+    CHECK(dmfsi_dmramfs_ioctl(ctx, NULL, DMRAMFS_IOCTL_DEDUP_STATS, &stats) == DMFSI_OK);
+    CHECK(stats.block_size == DMRAMFS_EXTENT_SIZE);
+    return stats;
+}
+
+int main(void)
+{
+    dmfsi_context_t ctx = dmfsi_dmramfs_init(NULL);
+    CHECK(ctx != NULL);
+
+    // Two identical files of distinct blocks and a partial block, which is not shared
+    static char data[BLOCKS * DMRAMFS_EXTENT_SIZE + 10];
+    for (size_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = (char)(i / DMRAMFS_EXTENT_SIZE + i % 7);
+    }
+    create_file(ctx, "/a", data, sizeof(data));
+    create_file(ctx, "/b", data, sizeof(data));
+    dmramfs_dedup_stats_t stats = dedup_stats(ctx);
+    CHECK(stats.blocks == BLOCKS);
+    CHECK(stats.references == 2 * BLOCKS);
+
+    // A write to a shared block copies it, the other file keeps the old data
+    void* fp = test_open(ctx, "/a", DMFSI_O_RDWR);
+    test_write(ctx, fp, "changed", 7);
+    dmfsi_dmramfs_fclose(ctx, fp);
+    static char check[sizeof(data)];
+    fp = test_open(ctx, "/b", DMFSI_O_RDONLY);
+    CHECK(test_pread(ctx, fp, 0, check, sizeof(check)) == sizeof(data));
+    CHECK(memcmp(check, data, sizeof(data)) == 0);
+    dmfsi_dmramfs_fclose(ctx, fp);
+    fp = test_open(ctx, "/a", DMFSI_O_RDONLY);
+    CHECK(test_pread(ctx, fp, 0, check, sizeof(check)) == sizeof(data));
+    CHECK(memcmp(check, "changed", 7) == 0);
+    CHECK(memcmp(&check[7], &data[7], sizeof(data) - 7) == 0);
+    dmfsi_dmramfs_fclose(ctx, fp);
+    stats = dedup_stats(ctx);
+    CHECK(stats.blocks == BLOCKS + 1);
+    CHECK(stats.references == 2 * BLOCKS);
+
+    // Removing the files releases their entries of the table
+    CHECK(dmfsi_dmramfs_unlink(ctx, "/b") == DMFSI_OK);
+    stats = dedup_stats(ctx);
+    CHECK(stats.blocks == BLOCKS);
+    CHECK(stats.references == BLOCKS);
+    CHECK(dmfsi_dmramfs_unlink(ctx, "/a") == DMFSI_OK);
+    stats = dedup_stats(ctx);
+    CHECK(stats.blocks == 0);
+    CHECK(stats.references == 0);
+
+    dmfsi_dmramfs_deinit(ctx);
+    return 0;
+}
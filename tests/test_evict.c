@@ -0,0 +1,44 @@
+/**
+ * @brief A write over the quota evicts cold files before it fails
+ */
+#include "test_common.h"
+#include <stdbool.h>
+
+int main(void)
+{
+    dmfsi_context_t ctx = dmfsi_dmramfs_init("size=64k");
+    CHECK(ctx != NULL);
+
+    // Fill most of the quota with a closed evictable file
+    static char data[32 * 1024];
+    memset(data, 'c', sizeof(data));
+    void* fp = test_open(ctx, "/cold", DMFSI_O_CREAT | DMFSI_O_RDWR);
+    bool evictable = true;
+    CHECK(dmfsi_dmramfs_ioctl(ctx, fp, DMRAMFS_IOCTL_EVICTABLE, &evictable) == DMFSI_OK);
+    test_write(ctx, fp, data, sizeof(data));
+    dmfsi_dmramfs_fclose(ctx, fp);
+
+    // Each write entry point succeeds once the cold file is gone
+    memset(data, 'h', sizeof(data));
+    fp = test_open(ctx, "/hot", DMFSI_O_CREAT | DMFSI_O_RDWR);
+    test_write(ctx, fp, data, sizeof(data) / 2);
+    dmramfs_io_t io = { .offset = sizeof(data) / 2, .buffer = data, .size = sizeof(data) / 2 };
+    CHECK(dmfsi_dmramfs_ioctl(ctx, fp, DMRAMFS_IOCTL_PWRITE, &io) == DMFSI_OK);
+    CHECK(dmfsi_dmramfs_size(ctx, fp) == sizeof(data));
+
+    void* cold = NULL;
+    CHECK(dmfsi_dmramfs_fopen(ctx, &cold, "/cold", DMFSI_O_RDONLY, 0) != DMFSI_OK);
+
+    static char check[sizeof(data)];
+    CHECK(test_pread(ctx, fp, 0, check, sizeof(check)) == sizeof(check));
+    CHECK(memcmp(check, data, sizeof(data)) == 0);
+
+    // Without anything left to evict the write fails and the file is unchanged
+    io.offset = sizeof(data);
+    io.size = sizeof(data);
+    CHECK(dmfsi_dmramfs_ioctl(ctx, fp, DMRAMFS_IOCTL_PWRITE, &io) != DMFSI_OK);
+    CHECK(dmfsi_dmramfs_size(ctx, fp) == sizeof(data));
+    dmfsi_dmramfs_fclose(ctx, fp);
+    dmfsi_dmramfs_deinit(ctx);
+    return 0;
+}
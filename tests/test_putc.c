@@ -0,0 +1,45 @@
+/**
+ * @brief Characters written and read through the cached extent of a handle
+ */
+#include "test_common.h"
+
+int main(void)
+{
+    dmfsi_context_t ctx = dmfsi_dmramfs_init(NULL);
+    CHECK(ctx != NULL);
+
+    // Without a cached extent an invalid context is refused
+    void* fp = test_open(ctx, "/file", DMFSI_O_CREAT | DMFSI_O_RDWR);
+    CHECK(dmfsi_dmramfs_putc(NULL, fp, 'x') == -1);
+    CHECK(dmfsi_dmramfs_getc(NULL, fp) == -1);
+    CHECK(dmfsi_dmramfs_size(ctx, fp) == 0);
+
+    // Characters crossing extent boundaries round trip
+    size_t size = 3 * DMRAMFS_EXTENT_SIZE + 5;
+    for (size_t i = 0; i < size; i++)
+    {
+        CHECK(dmfsi_dmramfs_putc(ctx, fp, (int)('a' + i % 26)) == (int)('a' + i % 26));
+    }
+    CHECK(dmfsi_dmramfs_size(ctx, fp) == (long)size);
+    CHECK(dmfsi_dmramfs_lseek(ctx, fp, 0, DMFSI_SEEK_SET) == 0);
+    for (size_t i = 0; i < size; i++)
+    {
+        CHECK(dmfsi_dmramfs_getc(ctx, fp) == (int)('a' + i % 26));
+    }
+    CHECK(dmfsi_dmramfs_getc(ctx, fp) == -1);
+
+    // The cached extent is written under the lock of the mount of the file
+    dmfsi_context_t other = dmfsi_dmramfs_init(NULL);
+    CHECK(other != NULL);
+    CHECK(dmfsi_dmramfs_lseek(ctx, fp, 0, DMFSI_SEEK_SET) == 0);
+    CHECK(dmfsi_dmramfs_putc(ctx, fp, 'A') == 'A');
+    CHECK(dmfsi_dmramfs_putc(other, fp, 'B') == 'B');
+    char check[2];
+    CHECK(test_pread(ctx, fp, 0, check, sizeof(check)) == sizeof(check));
+    CHECK(memcmp(check, "AB", 2) == 0);
+    dmfsi_dmramfs_deinit(other);
+
+    dmfsi_dmramfs_fclose(ctx, fp);
+    dmfsi_dmramfs_deinit(ctx);
+    return 0;
+}
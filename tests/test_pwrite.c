@@ -0,0 +1,36 @@
+/**
+ * @brief Positional writes with ranges ending beyond SIZE_MAX
+ */
+#include "test_common.h"
+#include <stdint.h>
+
+int main(void)
+{
+    dmfsi_context_t ctx = dmfsi_dmramfs_init(NULL);
+    CHECK(ctx != NULL);
+    void* fp = test_open(ctx, "/file", DMFSI_O_CREAT | DMFSI_O_RDWR);
+    test_write(ctx, fp, "abc", 3);
+
+    // The end of the range would wrap around
+    char data[10] = "0123456789";
+    dmramfs_io_t io = { .offset = SIZE_MAX - 5, .buffer = data, .size = sizeof(data) };
+    CHECK(dmfsi_dmramfs_ioctl(ctx, fp, DMRAMFS_IOCTL_PWRITE, &io) == DMFSI_ERR_INVALID);
+    CHECK(io.transferred == 0);
+
+    // A range ending just before SIZE_MAX cannot be backed either
+    io.offset = SIZE_MAX - 20;
+    CHECK(dmfsi_dmramfs_ioctl(ctx, fp, DMRAMFS_IOCTL_PWRITE, &io) != DMFSI_OK);
+    size_t size = SIZE_MAX;
+    CHECK(dmfsi_dmramfs_ioctl(ctx, fp, DMRAMFS_IOCTL_PREALLOCATE, &size) != DMFSI_OK);
+    CHECK(dmfsi_dmramfs_ioctl(ctx, fp, DMRAMFS_IOCTL_TRUNCATE, &size) != DMFSI_OK);
+
+    // The file is not changed
+    char buffer[8];
+    CHECK(dmfsi_dmramfs_size(ctx, fp) == 3);
+    CHECK(test_pread(ctx, fp, 0, buffer, sizeof(buffer)) == 3);
+    CHECK(memcmp(buffer, "abc", 3) == 0);
+
+    dmfsi_dmramfs_fclose(ctx, fp);
+    dmfsi_dmramfs_deinit(ctx);
+    return 0;
+}
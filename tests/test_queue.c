@@ -0,0 +1,108 @@
+/**
+ * @brief Operations submitted, executed and reaped through the queue of a mount
+ */
+#include "test_common.h"
+
+#ifndef DMRAMFS_QUEUE_SIZE
+#   define DMRAMFS_QUEUE_SIZE 32
+#endif
+
+static dmfsi_context_t ctx;
+
+/**
+ * @brief Submit operations, returning the number accepted
+ */
+static size_t submit(dmramfs_op_t** ops, size_t count, int flags)
+{
+    dmramfs_batch_t batch = { .ops = ops, .count = count, .flags = flags };
+    CHECK(dmfsi_dmramfs_ioctl(ctx, NULL, DMRAMFS_IOCTL_SUBMIT, &batch) == DMFSI_OK);
+    return batch.done;
+}
+
+/**
+ * @brief Reap completed operations, returning the number collected
+ */
+static size_t reap(dmramfs_op_t** ops, size_t count)
+{
+    dmramfs_batch_t batch = { .ops = ops, .count = count };
+    CHECK(dmfsi_dmramfs_ioctl(ctx, NULL, DMRAMFS_IOCTL_REAP, &batch) == DMFSI_OK);
+    return batch.done;
+}
+
+/**
+ * @brief Execute the queue, returning the number of operations executed
+ */
+static size_t process(void)
+{
+    size_t processed = 0;
+    CHECK(dmfsi_dmramfs_ioctl(ctx, NULL, DMRAMFS_IOCTL_PROCESS, &processed) == DMFSI_OK);
+    return processed;
+}
+
+int main(void)
+{
+    ctx = dmfsi_dmramfs_init(NULL);
+    CHECK(ctx != NULL);
+
+    // The operations after the open take its handle through link
+    char data[] = "hello world";
+    char check[16] = { 0 };
+    dmramfs_op_t open = { .opcode = DMRAMFS_OP_OPEN, .path = "/file", .mode = DMFSI_O_CREAT | DMFSI_O_RDWR };
+    dmramfs_op_t write = { .opcode = DMRAMFS_OP_WRITE, .link = &open, .buffer = data, .size = 11 };
+    dmramfs_op_t pwrite = { .opcode = DMRAMFS_OP_PWRITE, .link = &open, .offset = 6, .buffer = "queue", .size = 5 };
+    dmramfs_op_t pread = { .opcode = DMRAMFS_OP_PREAD, .link = &open, .buffer = check, .size = sizeof(check) };
+    dmramfs_op_t close = { .opcode = DMRAMFS_OP_CLOSE, .link = &open };
+    dmramfs_op_t* ops[] = { &open, &write, &pwrite, &pread, &close };
+    CHECK(submit(ops, 5, DMRAMFS_BATCH_PROCESS) == 5);
+    dmramfs_op_t* done[DMRAMFS_QUEUE_SIZE + 4];
+    CHECK(reap(done, 8) == 5);
+    for (size_t i = 0; i < 5; i++)
+    {
+        CHECK(done[i] == ops[i]);
+        CHECK(done[i]->result == DMFSI_OK);
+    }
+    CHECK(write.transferred == 11 && pwrite.transferred == 5 && pread.transferred == 11);
+    CHECK(memcmp(check, "hello queue", 11) == 0);
+
+    // Without DMRAMFS_BATCH_PROCESS the operations wait for a later PROCESS
+    dmfsi_stat_t stat;
+    dmramfs_op_t query = { .opcode = DMRAMFS_OP_STAT, .path = "/file", .buffer = &stat };
+    ops[0] = &query;
+    CHECK(submit(ops, 1, 0) == 1);
+    CHECK(reap(done, 1) == 0);
+    CHECK(process() == 1);
+    CHECK(reap(done, 1) == 1 && done[0] == &query);
+    CHECK(query.result == DMFSI_OK && stat.size == 11);
+
+    // An operation linked to a failed open gets no handle
+    dmramfs_op_t missing = { .opcode = DMRAMFS_OP_OPEN, .path = "/missing", .mode = DMFSI_O_RDONLY };
+    dmramfs_op_t read = { .opcode = DMRAMFS_OP_READ, .link = &missing, .buffer = check, .size = sizeof(check) };
+    ops[0] = &missing;
+    ops[1] = &read;
+    CHECK(submit(ops, 2, DMRAMFS_BATCH_PROCESS) == 2);
+    CHECK(reap(done, 2) == 2);
+    CHECK(missing.result != DMFSI_OK && read.result != DMFSI_OK && read.transferred == 0);
+
+    // Submitted and unreaped completed operations together fill the queue
+    static dmramfs_op_t stats[DMRAMFS_QUEUE_SIZE + 4];
+    static dmramfs_op_t* pending[DMRAMFS_QUEUE_SIZE + 4];
+    for (size_t i = 0; i < DMRAMFS_QUEUE_SIZE + 4; i++)
+    {
+        stats[i] = query;
+        pending[i] = &stats[i];
+    }
+    CHECK(submit(pending, DMRAMFS_QUEUE_SIZE + 4, 0) == DMRAMFS_QUEUE_SIZE);
+    CHECK(submit(&pending[DMRAMFS_QUEUE_SIZE], 4, 0) == 0);
+    CHECK(process() == DMRAMFS_QUEUE_SIZE);
+    CHECK(submit(&pending[DMRAMFS_QUEUE_SIZE], 4, 0) == 0);
+    CHECK(reap(done, DMRAMFS_QUEUE_SIZE + 4) == DMRAMFS_QUEUE_SIZE);
+    CHECK(submit(&pending[DMRAMFS_QUEUE_SIZE], 4, DMRAMFS_BATCH_PROCESS) == 4);
+    CHECK(reap(done, DMRAMFS_QUEUE_SIZE + 4) == 4);
+    for (size_t i = 0; i < DMRAMFS_QUEUE_SIZE + 4; i++)
+    {
+        CHECK(stats[i].result == DMFSI_OK);
+    }
+
+    dmfsi_dmramfs_deinit(ctx);
+    return 0;
+}
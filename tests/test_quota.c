@@ -0,0 +1,122 @@
+/**
+ * @brief The size quota covers the metadata as well as the file data
+ */
+#include "test_common.h"
+#include <stdbool.h>
+
+/**
+ * @brief Check that the mount uses no more than its quota
+ */
+static void check_usage(dmfsi_context_t ctx)
+{
+    dmramfs_statfs_t statfs;
+    CHECK(dmfsi_dmramfs_ioctl(ctx, NULL, DMRAMFS_IOCTL_STATFS, &statfs) == DMFSI_OK);
+    CHECK(statfs.data_bytes + statfs.metadata_bytes <= statfs.quota_bytes);
+}
+
+int main(void)
+{
+    // Limits that do not fit a size_t are rejected instead of wrapping around
+    CHECK(dmfsi_dmramfs_init("size=99999999999999999999999") == NULL);
+    CHECK(dmfsi_dmramfs_init("nr_inodes=99999999999999999999999") == NULL);
+    CHECK(dmfsi_dmramfs_init("size=18446744073709551615g") == NULL);
+    dmfsi_context_t limited = dmfsi_dmramfs_init("size=1g,nr_inodes=4294967295");
+    CHECK(limited != NULL);
+    dmramfs_statfs_t statfs;
+    CHECK(dmfsi_dmramfs_ioctl(limited, NULL, DMRAMFS_IOCTL_STATFS, &statfs) == DMFSI_OK);
+    CHECK(statfs.quota_bytes == (1u << 30) && statfs.quota_inodes == 4294967295u);
+    dmfsi_dmramfs_deinit(limited);
+
+    // Creating files stops when their nodes no longer fit
+    dmfsi_context_t ctx = dmfsi_dmramfs_init("size=16k");
+    CHECK(ctx != NULL);
+    int created = 0;
+    for (int i = 0; i < 200; i++)
+    {
+        char path[32];
+        snprintf(path, sizeof(path), "/file-with-a-long-name-%d", i);
+        void* fp = NULL;
+        if (dmfsi_dmramfs_fopen(ctx, &fp, path, DMFSI_O_CREAT | DMFSI_O_RDWR, 0) == DMFSI_OK)
+        {
+            dmfsi_dmramfs_fclose(ctx, fp);
+            created++;
+        }
+        check_usage(ctx);
+    }
+    CHECK(created > 0 && created < 200);
+
+    // Removed files leave free slab objects for the names and the rest of
+    // the quota is taken by data, so renaming the other files over and over
+    // only runs out of memory when the index grows.
+    // A rename that fails leaves the file under its old name.
+    for (int i = 0; i < 200; i += 2)
+    {
+        char path[32];
+        snprintf(path, sizeof(path), "/file-with-a-long-name-%d", i);
+        dmfsi_dmramfs_unlink(ctx, path);
+    }
+    void* filler = test_open(ctx, "/filler", DMFSI_O_CREAT | DMFSI_O_RDWR);
+    static char data[DMRAMFS_EXTENT_SIZE];
+    size_t filled = 0;
+    while (dmfsi_dmramfs_fwrite(ctx, filler, data, sizeof(data), NULL) == DMFSI_OK)
+    {
+        filled += sizeof(data);
+    }
+    CHECK(dmfsi_dmramfs_size(ctx, filler) == (long)filled);
+    bool failed = false;
+    for (int round = 0; round < 64 && !failed; round++)
+    {
+        for (int i = 1; i < 200 && !failed; i += 2)
+        {
+            char path[32];
+            char target[32];
+            dmfsi_stat_t stat;
+            if (round == 0)
+            {
+                snprintf(path, sizeof(path), "/file-with-a-long-name-%d", i);
+            }
+            else
+            {
+                snprintf(path, sizeof(path), "/file-renamed-%d-%d", round - 1, i);
+            }
+            snprintf(target, sizeof(target), "/file-renamed-%d-%d", round, i);
+            if (dmfsi_dmramfs_stat(ctx, path, &stat) != DMFSI_OK)
+            {
+                continue;
+            }
+            failed = (dmfsi_dmramfs_rename(ctx, path, target) != DMFSI_OK);
+            CHECK(failed != (dmfsi_dmramfs_stat(ctx, target, &stat) == DMFSI_OK));
+            CHECK(failed == (dmfsi_dmramfs_stat(ctx, path, &stat) == DMFSI_OK));
+            check_usage(ctx);
+        }
+    }
+    CHECK(failed);
+    dmfsi_dmramfs_fclose(ctx, filler);
+    CHECK(dmfsi_dmramfs_mkdir(ctx, "/dir", 0) != DMFSI_OK || dmfsi_dmramfs_mkdir(ctx, "/dir/sub", 0) != DMFSI_OK);
+    check_usage(ctx);
+    dmfsi_dmramfs_deinit(ctx);
+
+    // A write far beyond the end of file only pays for the nodes leading to its extent
+    ctx = dmfsi_dmramfs_init("size=64k");
+    CHECK(ctx != NULL);
+    void* fp = test_open(ctx, "/sparse", DMFSI_O_CREAT | DMFSI_O_RDWR);
+    dmramfs_io_t io = { .offset = 100u << 20, .buffer = "x", .size = 1 };
+    CHECK(dmfsi_dmramfs_ioctl(ctx, fp, DMRAMFS_IOCTL_PWRITE, &io) == DMFSI_OK);
+    CHECK(dmfsi_dmramfs_size(ctx, fp) == (100u << 20) + 1);
+    dmramfs_fstat_t fstat;
+    CHECK(dmfsi_dmramfs_ioctl(ctx, fp, DMRAMFS_IOCTL_FSTAT, &fstat) == DMFSI_OK);
+    CHECK(fstat.allocated == DMRAMFS_EXTENT_SIZE);
+    check_usage(ctx);
+
+    // Punching the extent out again leaves the file a single hole
+    dmramfs_range_t range = { .offset = 0, .length = fstat.size };
+    CHECK(dmfsi_dmramfs_ioctl(ctx, fp, DMRAMFS_IOCTL_PUNCH_HOLE, &range) == DMFSI_OK);
+    CHECK(dmfsi_dmramfs_ioctl(ctx, fp, DMRAMFS_IOCTL_FSTAT, &fstat) == DMFSI_OK);
+    CHECK(fstat.allocated == 0 && fstat.size == (100u << 20) + 1);
+    char byte = 'y';
+    CHECK(test_pread(ctx, fp, 100u << 20, &byte, 1) == 1 && byte == 0);
+    check_usage(ctx);
+    dmfsi_dmramfs_fclose(ctx, fp);
+    dmfsi_dmramfs_deinit(ctx);
+    return 0;
+}
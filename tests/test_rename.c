@@ -0,0 +1,60 @@
+/**
+ * @brief Renaming onto an existing name replaces the file, unless it is open
+ */
+#include "test_common.h"
+
+/**
+ * @brief Count the entries of the root directory called @p name
+ */
+static int count_entries(dmfsi_context_t ctx, const char* name)
+{
+    void* dp = NULL;
+    CHECK(dmfsi_dmramfs_opendir(ctx, &dp, "/") == DMFSI_OK);
+    int count = 0;
+    dmfsi_dir_entry_t entry;
+    while (dmfsi_dmramfs_readdir(ctx, dp, &entry) == DMFSI_OK)
+    {
+        count += (strcmp(entry.name, name) == 0);
+    }
+    dmfsi_dmramfs_closedir(ctx, dp);
+    return count;
+}
+
+int main(void)
+{
+    dmfsi_context_t ctx = dmfsi_dmramfs_init(NULL);
+    CHECK(ctx != NULL);
+
+    void* fp = test_open(ctx, "/a", DMFSI_O_CREAT | DMFSI_O_RDWR);
+    test_write(ctx, fp, "source", 6);
+    dmfsi_dmramfs_fclose(ctx, fp);
+    fp = test_open(ctx, "/b", DMFSI_O_CREAT | DMFSI_O_RDWR);
+    test_write(ctx, fp, "replaced target", 15);
+    dmfsi_dmramfs_fclose(ctx, fp);
+
+    // The target is replaced by the source
+    CHECK(dmfsi_dmramfs_rename(ctx, "/a", "/b") == DMFSI_OK);
+    CHECK(count_entries(ctx, "a") == 0);
+    CHECK(count_entries(ctx, "b") == 1);
+    char check[16] = { 0 };
+    fp = test_open(ctx, "/b", DMFSI_O_RDONLY);
+    CHECK(dmfsi_dmramfs_size(ctx, fp) == 6);
+    CHECK(test_pread(ctx, fp, 0, check, sizeof(check)) == 6);
+    CHECK(memcmp(check, "source", 6) == 0);
+    dmfsi_dmramfs_fclose(ctx, fp);
+
+    // Renaming a file onto itself keeps it
+    CHECK(dmfsi_dmramfs_rename(ctx, "/b", "/b") == DMFSI_OK);
+    CHECK(count_entries(ctx, "b") == 1);
+
+    // An open target is not replaced and both files are left as they were
+    fp = test_open(ctx, "/c", DMFSI_O_CREAT | DMFSI_O_RDWR);
+    CHECK(dmfsi_dmramfs_rename(ctx, "/b", "/c") != DMFSI_OK);
+    CHECK(count_entries(ctx, "b") == 1);
+    CHECK(count_entries(ctx, "c") == 1);
+    CHECK(dmfsi_dmramfs_size(ctx, fp) == 0);
+    dmfsi_dmramfs_fclose(ctx, fp);
+
+    dmfsi_dmramfs_deinit(ctx);
+    return 0;
+}
@@ -0,0 +1,45 @@
+/**
+ * @brief Visibility of the data written into reserved regions
+ */
+#include "test_common.h"
+
+int main(void)
+{
+    dmfsi_context_t ctx = dmfsi_dmramfs_init(NULL);
+    CHECK(ctx != NULL);
+    void* writer = test_open(ctx, "/file", DMFSI_O_CREAT | DMFSI_O_RDWR);
+    void* reader = test_open(ctx, "/file", DMFSI_O_RDONLY);
+    test_write(ctx, writer, "abcdefgh", 8);
+    CHECK(dmfsi_dmramfs_lseek(ctx, writer, 4, DMFSI_SEEK_SET) == 4);
+
+    // Within the current size the region is the file data itself
+    dmramfs_reserve_t reserve = { .size = 8 };
+    CHECK(dmfsi_dmramfs_ioctl(ctx, writer, DMRAMFS_IOCTL_RESERVE, &reserve) == DMFSI_OK);
+    CHECK(reserve.length == 8);
+    memcpy(reserve.data, "QQQQRRRR", 8);
+    char buffer[16];
+    CHECK(test_pread(ctx, reader, 0, buffer, sizeof(buffer)) == 8);
+    CHECK(memcmp(buffer, "abcdQQQQ", 8) == 0);
+
+    // Beyond the end of file it only becomes visible when committed
+    CHECK(dmfsi_dmramfs_size(ctx, reader) == 8);
+    size_t committed = 8;
+    CHECK(dmfsi_dmramfs_ioctl(ctx, writer, DMRAMFS_IOCTL_COMMIT, &committed) == DMFSI_OK);
+    CHECK(dmfsi_dmramfs_size(ctx, reader) == 12);
+    CHECK(test_pread(ctx, reader, 0, buffer, sizeof(buffer)) == 12);
+    CHECK(memcmp(buffer, "abcdQQQQRRRR", 12) == 0);
+    CHECK(dmfsi_dmramfs_lseek(ctx, writer, 0, DMFSI_SEEK_CUR) == 12);
+
+    // A region that is not committed does not extend the file
+    reserve.size = 4;
+    CHECK(dmfsi_dmramfs_ioctl(ctx, writer, DMRAMFS_IOCTL_RESERVE, &reserve) == DMFSI_OK);
+    memcpy(reserve.data, "SSSS", 4);
+    committed = 0;
+    CHECK(dmfsi_dmramfs_ioctl(ctx, writer, DMRAMFS_IOCTL_COMMIT, &committed) == DMFSI_OK);
+    CHECK(dmfsi_dmramfs_size(ctx, reader) == 12);
+
+    dmfsi_dmramfs_fclose(ctx, reader);
+    dmfsi_dmramfs_fclose(ctx, writer);
+    dmfsi_dmramfs_deinit(ctx);
+    return 0;
+}
@@ -0,0 +1,76 @@
+/**
+ * @brief A snapshot captures all files at the same point in time
+ */
+#include "test_common.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define TEST_ROUNDS 20000
+
+static dmfsi_context_t ctx;
+
+/**
+ * @brief Write increasing counters to /a and then to /b, one write at a time
+ */
+static void* writer(void* arg)
+{
+    void* a = test_open(ctx, "/a", DMFSI_O_RDWR);
+    void* b = test_open(ctx, "/b", DMFSI_O_RDWR);
+    for (uint32_t round = 1; round <= TEST_ROUNDS; round++)
+    {
+        dmramfs_io_t io = { .offset = 0, .buffer = &round, .size = sizeof(round) };
+        CHECK(dmfsi_dmramfs_ioctl(ctx, a, DMRAMFS_IOCTL_PWRITE, &io) == DMFSI_OK);
+        CHECK(dmfsi_dmramfs_ioctl(ctx, b, DMRAMFS_IOCTL_PWRITE, &io) == DMFSI_OK);
+    }
+    dmfsi_dmramfs_fclose(ctx, a);
+    dmfsi_dmramfs_fclose(ctx, b);
+    atomic_store((atomic_bool*)arg, true);
+    return NULL;
+}
+
+/**
+ * @brief Read the counter of a file in a snapshot
+ */
+static uint32_t read_counter(dmfsi_context_t snapshot, const char* path)
+{
+    uint32_t counter = 0;
+    void* fp = test_open(snapshot, path, DMFSI_O_RDONLY);
+    CHECK(test_pread(snapshot, fp, 0, &counter, sizeof(counter)) == sizeof(counter));
+    dmfsi_dmramfs_fclose(snapshot, fp);
+    return counter;
+}
+
+int main(void)
+{
+#if defined(DMRAMFS_THREAD_SAFE) && !DMRAMFS_THREAD_SAFE
+    return 0;
+#else
+    ctx = dmfsi_dmramfs_init(NULL);
+    CHECK(ctx != NULL);
+    uint32_t zero = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        void* fp = test_open(ctx, i == 0 ? "/a" : "/b", DMFSI_O_CREAT | DMFSI_O_RDWR);
+        test_write(ctx, fp, &zero, sizeof(zero));
+        dmfsi_dmramfs_fclose(ctx, fp);
+    }
+
+    // /a is always written first, so no snapshot may see /b ahead of it
+    atomic_bool done = false;
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, writer, (void*)&done) == 0);
+    while (!atomic_load(&done))
+    {
+        dmfsi_context_t snapshot = NULL;
+        CHECK(dmfsi_dmramfs_ioctl(ctx, NULL, DMRAMFS_IOCTL_SNAPSHOT, &snapshot) == DMFSI_OK);
+        uint32_t a = read_counter(snapshot, "/a");
+        uint32_t b = read_counter(snapshot, "/b");
+        CHECK(b <= a && a - b <= 1);
+        dmfsi_dmramfs_deinit(snapshot);
+    }
+    pthread_join(thread, NULL);
+    dmfsi_dmramfs_deinit(ctx);
+    return 0;
+#endif
+}
@@ -0,0 +1,112 @@
+/**
+ * @brief Vectored reads and writes across the inline data and extent boundaries
+ */
+#include "test_common.h"
+
+#ifndef DMRAMFS_INLINE_SIZE
+#   define DMRAMFS_INLINE_SIZE 32
+#endif
+
+#define TEST_SIZE (2 * DMRAMFS_EXTENT_SIZE + DMRAMFS_INLINE_SIZE)
+
+/**
+ * @brief Read or write segments at the handle position
+ */
+static int transfer(dmfsi_context_t ctx, void* fp, int request, const dmramfs_iovec_t* iov, size_t count, size_t* transferred)
+{
+    dmramfs_vector_t vector = { .iov = iov, .count = count, .transferred = SIZE_MAX };
+    int result = dmfsi_dmramfs_ioctl(ctx, fp, request, &vector);
+    *transferred = vector.transferred;
+    return result;
+}
+
+/**
+ * @brief Check that a file holds exactly @p size bytes of @p data
+ */
+static void check_file(dmfsi_context_t ctx, void* fp, const char* data, size_t size)
+{
+    static char check[2 * TEST_SIZE];
+    CHECK(dmfsi_dmramfs_size(ctx, fp) == (long)size);
+    CHECK(test_pread(ctx, fp, 0, check, sizeof(check)) == size);
+    CHECK(memcmp(check, data, size) == 0);
+}
+
+int main(void)
+{
+    dmfsi_context_t ctx = dmfsi_dmramfs_init("size=64k");
+    CHECK(ctx != NULL);
+    static char data[TEST_SIZE];
+    for (size_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = (char)('a' + i % 19);
+    }
+
+    // A write within the inline data, then segments crossing it and an extent boundary
+    void* fp = test_open(ctx, "/file", DMFSI_O_CREAT | DMFSI_O_RDWR);
+    size_t first = DMRAMFS_INLINE_SIZE - 2;
+    size_t transferred = 0;
+    dmramfs_iovec_t small[] = {
+        { data, 3 },
+        { NULL, 0 },
+        { &data[3], first - 3 },
+    };
+    CHECK(transfer(ctx, fp, DMRAMFS_IOCTL_WRITEV, small, 3, &transferred) == DMFSI_OK);
+    CHECK(transferred == first);
+    check_file(ctx, fp, data, first);
+    size_t second = DMRAMFS_EXTENT_SIZE - first + 5;
+    dmramfs_iovec_t large[] = {
+        { &data[first], 4 },
+        { &data[first + 4], second },
+        { data, 0 },
+        { &data[first + 4 + second], TEST_SIZE - first - 4 - second },
+    };
+    CHECK(transfer(ctx, fp, DMRAMFS_IOCTL_WRITEV, large, 4, &transferred) == DMFSI_OK);
+    CHECK(transferred == TEST_SIZE - first);
+    CHECK(dmfsi_dmramfs_lseek(ctx, fp, 0, DMFSI_SEEK_CUR) == TEST_SIZE);
+    check_file(ctx, fp, data, TEST_SIZE);
+
+    // Reads fill the segments in order and stop at the end of file
+    static char parts[3][TEST_SIZE];
+    CHECK(dmfsi_dmramfs_lseek(ctx, fp, 3, DMFSI_SEEK_SET) == 3);
+    dmramfs_iovec_t read[] = {
+        { NULL, 0 },
+        { parts[0], DMRAMFS_INLINE_SIZE },
+        { parts[1], DMRAMFS_EXTENT_SIZE },
+        { parts[2], TEST_SIZE },
+    };
+    CHECK(transfer(ctx, fp, DMRAMFS_IOCTL_READV, read, 4, &transferred) == DMFSI_OK);
+    CHECK(transferred == TEST_SIZE - 3);
+    CHECK(dmfsi_dmramfs_lseek(ctx, fp, 0, DMFSI_SEEK_CUR) == TEST_SIZE);
+    CHECK(memcmp(parts[0], &data[3], DMRAMFS_INLINE_SIZE) == 0);
+    CHECK(memcmp(parts[1], &data[3 + DMRAMFS_INLINE_SIZE], DMRAMFS_EXTENT_SIZE) == 0);
+    CHECK(memcmp(parts[2], &data[3 + DMRAMFS_INLINE_SIZE + DMRAMFS_EXTENT_SIZE], TEST_SIZE - 3 - DMRAMFS_INLINE_SIZE - DMRAMFS_EXTENT_SIZE) == 0);
+    read[2].base = NULL;
+    CHECK(dmfsi_dmramfs_lseek(ctx, fp, 0, DMFSI_SEEK_SET) == 0);
+    CHECK(transfer(ctx, fp, DMRAMFS_IOCTL_READV, read, 4, &transferred) == DMFSI_ERR_INVALID);
+    CHECK(dmfsi_dmramfs_lseek(ctx, fp, 0, DMFSI_SEEK_CUR) == 0);
+
+    // A failing segment leaves the file and the position untouched
+    dmramfs_iovec_t invalid[] = {
+        { "XXXX", 4 },
+        { NULL, 5 },
+    };
+    CHECK(transfer(ctx, fp, DMRAMFS_IOCTL_WRITEV, invalid, 2, &transferred) == DMFSI_ERR_INVALID);
+    CHECK(transferred == 0);
+    CHECK(dmfsi_dmramfs_lseek(ctx, fp, 0, DMFSI_SEEK_CUR) == 0);
+    check_file(ctx, fp, data, TEST_SIZE);
+
+    // So does a write beyond the quota of the mount
+    static char huge[64 * 1024];
+    dmramfs_iovec_t over[] = {
+        { "XXXX", 4 },
+        { huge, sizeof(huge) },
+    };
+    CHECK(transfer(ctx, fp, DMRAMFS_IOCTL_WRITEV, over, 2, &transferred) != DMFSI_OK);
+    CHECK(transferred == 0);
+    CHECK(dmfsi_dmramfs_lseek(ctx, fp, 0, DMFSI_SEEK_CUR) == 0);
+    check_file(ctx, fp, data, TEST_SIZE);
+
+    dmfsi_dmramfs_fclose(ctx, fp);
+    dmfsi_dmramfs_deinit(ctx);
+    return 0;
+}
@@ -0,0 +1,52 @@
+/**
+ * @brief Mapped views and reserved regions of a file shared by several handles
+ */
+#include "test_common.h"
+
+int main(void)
+{
+    dmfsi_context_t ctx = dmfsi_dmramfs_init(NULL);
+    CHECK(ctx != NULL);
+    char data[600];
+    memset(data, 'A', sizeof(data));
+    void* reader = test_open(ctx, "/file", DMFSI_O_CREAT | DMFSI_O_RDWR);
+    void* writer = test_open(ctx, "/file", DMFSI_O_RDWR);
+    test_write(ctx, writer, data, sizeof(data));
+    CHECK(dmfsi_dmramfs_lseek(ctx, writer, 0, DMFSI_SEEK_SET) == 0);
+
+    // A reservation taken before the view blocks mapping
+    dmramfs_reserve_t reserve = { .size = 4 };
+    CHECK(dmfsi_dmramfs_ioctl(ctx, writer, DMRAMFS_IOCTL_RESERVE, &reserve) == DMFSI_OK);
+    CHECK(reserve.length == 4);
+    dmramfs_map_t map = { .offset = 0 };
+    CHECK(dmfsi_dmramfs_ioctl(ctx, reader, DMRAMFS_IOCTL_MAP, &map) == DMFSI_ERR_INVALID);
+    size_t committed = 0;
+    CHECK(dmfsi_dmramfs_ioctl(ctx, writer, DMRAMFS_IOCTL_COMMIT, &committed) == DMFSI_OK);
+
+    // A pinned view blocks reserving and committing, so it never changes
+    CHECK(dmfsi_dmramfs_ioctl(ctx, reader, DMRAMFS_IOCTL_MAP, &map) == DMFSI_OK);
+    CHECK(map.length > 0 && ((const char*)map.data)[0] == 'A');
+    reserve.size = 4;
+    CHECK(dmfsi_dmramfs_ioctl(ctx, writer, DMRAMFS_IOCTL_RESERVE, &reserve) == DMFSI_ERR_INVALID);
+    CHECK(reserve.data == NULL);
+    committed = 4;
+    CHECK(dmfsi_dmramfs_ioctl(ctx, writer, DMRAMFS_IOCTL_COMMIT, &committed) == DMFSI_ERR_INVALID);
+    CHECK(dmfsi_dmramfs_fwrite(ctx, writer, "ZZZZ", 4, &committed) != DMFSI_OK);
+    CHECK(memcmp(map.data, data, map.length) == 0);
+    CHECK(dmfsi_dmramfs_ioctl(ctx, reader, DMRAMFS_IOCTL_UNMAP, NULL) == DMFSI_OK);
+
+    // Unpinned, the reservation works again
+    reserve.size = 4;
+    CHECK(dmfsi_dmramfs_ioctl(ctx, writer, DMRAMFS_IOCTL_RESERVE, &reserve) == DMFSI_OK);
+    memcpy(reserve.data, "ZZZZ", 4);
+    committed = 4;
+    CHECK(dmfsi_dmramfs_ioctl(ctx, writer, DMRAMFS_IOCTL_COMMIT, &committed) == DMFSI_OK);
+    char buffer[4];
+    CHECK(test_pread(ctx, reader, 0, buffer, sizeof(buffer)) == 4);
+    CHECK(memcmp(buffer, "ZZZZ", 4) == 0);
+
+    dmfsi_dmramfs_fclose(ctx, writer);
+    dmfsi_dmramfs_fclose(ctx, reader);
+    dmfsi_dmramfs_deinit(ctx);
+    return 0;
+}